@@ -0,0 +1,67 @@
+#include "dynamicresolution.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+// part of the budget aimed at (the GPU times vary from frame to frame)
+static const float BUDGET_MARGIN = 0.85f;
+
+// frames to wait before going up / down a step
+static const unsigned int UP_DELAY   = 30;
+static const unsigned int DOWN_DELAY = 3;
+
+DynamicResolution::DynamicResolution(float budget,float minScale,unsigned int nbSteps) :
+  _budget(budget),
+  _minScale(minScale),
+  _step((1.0f-minScale)/(float)max(nbSteps,1u)),
+  _enabled(true),
+  _scale(1.0f),
+  _ideal(1.0f),
+  _stable(0) {
+
+}
+
+void DynamicResolution::setEnabled(bool enabled) {
+  _enabled = enabled;
+  _scale   = 1.0f;
+  _ideal   = 1.0f;
+  _stable  = 0;
+}
+
+void DynamicResolution::update(float frameMs,float scaledMs) {
+  // nothing scaled this frame (e.g. culled passes)
+  if(!_enabled || scaledMs<=0.0f) return;
+
+  _stable++;
+
+  // scale of the scaled passes fitting in what the fixed ones leave
+  const float fixedMs  = max(frameMs-scaledMs,0.0f);
+  const float targetMs = BUDGET_MARGIN*_budget-fixedMs;
+  const float ideal    = targetMs<=0.0f ? _minScale : _scale*sqrt(targetMs/scaledMs);
+  _ideal = 0.8f*_ideal + 0.2f*min(max(ideal,_minScale),1.0f);
+
+  const float target = quantize(_ideal);
+  if(frameMs>_budget && target<_scale && _stable>=DOWN_DELAY) {
+    // over budget: straight to the fitting step
+    _scale  = target;
+    _stable = 0;
+  } else if(target>_scale && _stable>=UP_DELAY) {
+    // room left: one step up
+    _scale  = min(_scale+_step,1.0f);
+    _stable = 0;
+  }
+}
+
+void DynamicResolution::size(int width,int height,int &scaledWidth,int &scaledHeight) const {
+  scaledWidth  = max((int)ceil((float)width*_scale),1);
+  scaledHeight = max((int)ceil((float)height*_scale),1);
+}
+
+float DynamicResolution::quantize(float scale) const {
+  // highest step below the scale
+  if(_step<=0.0f) return 1.0f;
+  const float s = _minScale + floor((scale-_minScale)/_step + 1e-3f)*_step;
+  return min(max(s,_minScale),1.0f);
+}
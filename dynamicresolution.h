@@ -0,0 +1,45 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+// Internal resolution of the scene passes, chosen from their measured GPU
+// time against a frame budget. The cost of the scaled passes is taken as
+// proportional to their pixel count, the rest of the frame as fixed: the
+// scale giving the budget (minus a margin) is then a square root. The
+// scale moves by steps of (1-minScale)/nbSteps only: down as soon as a
+// frame is over budget, up one step at a time once the higher step has
+// fitted for a while (the render graph keeps the render targets at the
+// window size, a change of scale only changes their viewport).
+class DynamicResolution {
+ public:
+  DynamicResolution(float budget=1000.0f/60.0f,float minScale=0.5f,unsigned int nbSteps=4);
+
+  // frame budget (ms)
+  inline void  setBudget(float ms) {_budget = ms;}
+  inline float budget() const {return _budget;}
+
+  // disabled: full resolution
+  void setEnabled(bool enabled);
+  inline bool enabled() const {return _enabled;}
+
+  // GPU times of a frame (ms): the whole frame and the scaled passes of it
+  void update(float frameMs,float scaledMs);
+
+  // current scale of the width and height, in [minScale,1]
+  inline float scale() const {return _scale;}
+
+  // scaled size of the window
+  void size(int width,int height,int &scaledWidth,int &scaledHeight) const;
+
+ private:
+  float quantize(float scale) const;
+
+  float        _budget;
+  float        _minScale;
+  float        _step;
+  bool         _enabled;
+  float        _scale;
+  float        _ideal;   // smoothed scale fitting the budget
+  unsigned int _stable;  // frames since the last change
+};
+
+#endif // DYNAMICRESOLUTION_H
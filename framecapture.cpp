@@ -0,0 +1,401 @@
+#include "framecapture.h"
+#include "profiler.h"
+
+#include <QImage>
+#include <QMutexLocker>
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+// name of a frame of an image sequence: name-000042.ext
+static string sequenceName(const string &filename,unsigned int number) {
+  const size_t dot = filename.find_last_of('.');
+  char suffix[16];
+  sprintf(suffix,"-%06u",number);
+  return filename.substr(0,dot)+suffix+filename.substr(dot);
+}
+
+static bool endsWith(const string &s,const string &end) {
+  return s.size()>=end.size() && s.compare(s.size()-end.size(),end.size(),end)==0;
+}
+
+// persistent mapping of the pixel pack buffers
+static bool bufferStorage() {
+  return GLEW_ARB_buffer_storage || GLEW_VERSION_4_4;
+}
+
+FrameCapture::FrameCapture(unsigned int nbBuffers,unsigned int maxQueued) :
+  _nbBuffers(max(nbBuffers,2u)),
+  _maxQueued(max(maxQueued,1u)),
+  _session(NULL),
+  _width(0),
+  _height(0),
+  _number(0),
+  _writer(this),
+  _quit(false),
+  _allocated(0) {
+
+  _writer.start();
+}
+
+FrameCapture::~FrameCapture() {
+  stop();
+
+  // (the queued frames are written first)
+  _mutex.lock();
+  _quit = true;
+  _wake.wakeAll();
+  _mutex.unlock();
+  _writer.wait();
+
+  release();
+  for(unsigned int f=0;f<_free.size();++f) {
+    delete _free[f];
+  }
+}
+
+bool FrameCapture::start(const string &filename,float fps) {
+  stop();
+
+  Session *session  = new Session();
+  session->filename = filename;
+  session->format   = endsWith(filename,".y4m") ? Y4M : (endsWith(filename,".png") ? PNG : PPM);
+  session->fps      = fps;
+  session->stalls   = 0;
+  session->dropped  = 0;
+  session->written  = 0;
+  if(session->format==Y4M) {
+    session->video.open(filename.c_str(),ios::binary);
+    if(!session->video.is_open()) {
+      cout << "Warning: cannot write " << filename << endl;
+      delete session;
+      return false;
+    }
+  }
+
+  _session = session;
+  _width   = _height = 0;
+  _number  = 0;
+  return true;
+}
+
+void FrameCapture::readback(GLuint fbo,int width,int height) {
+  if(!_retired.empty()) {
+    release();
+  }
+  if(!_session) return;
+
+  PROFILE_ZONE("FrameCapture::readback");
+
+  // the capture keeps the size of its first frame
+  if(_number==0) {
+    _width  = width;
+    _height = height;
+  } else if(width!=_width || height!=_height) {
+    cout << "Warning: the window was resized, capture stopped" << endl;
+    stop();
+    return;
+  }
+
+  Buffer *buffer = freeBuffer((GLsizeiptr)width*height*4);
+  if(!buffer) {
+    // all the buffers are waiting for the writer
+    _session->dropped++;
+    _number++;
+    return;
+  }
+
+  // asynchronous copy in the buffer of this frame
+  glBindFramebuffer(GL_READ_FRAMEBUFFER,fbo);
+  glReadBuffer(fbo ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,buffer->pbo);
+  glReadPixels(0,0,width,height,GL_RGBA,GL_UNSIGNED_BYTE,(void *)0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+  buffer->fence  = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+  buffer->number = _number++;
+  _inFlight.push_back(buffer);
+
+  // the oldest frame (N-2 with 3 buffers)
+  if(_inFlight.size()>=_nbBuffers) {
+    collect(_inFlight.front());
+    _inFlight.pop_front();
+  }
+}
+
+void FrameCapture::stop() {
+  if(!_session) return;
+
+  // the frames in flight, oldest first
+  while(!_inFlight.empty()) {
+    collect(_inFlight.front());
+    _inFlight.pop_front();
+  }
+
+  // the buffers are deleted once the writer is done with them
+  _retired.insert(_retired.end(),_buffers.begin(),_buffers.end());
+  _buffers.clear();
+
+  // the writer ends the session after its last frame
+  Frame *frame   = newFrame(true);
+  frame->session = _session;
+  frame->buffer  = NULL;
+  frame->last    = true;
+  {
+    QMutexLocker locker(&_mutex);
+    _queue.push_back(frame);
+    _wake.wakeOne();
+  }
+  _session = NULL;
+
+  release();
+}
+
+FrameCapture::Buffer *FrameCapture::freeBuffer(GLsizeiptr size) {
+  {
+    QMutexLocker locker(&_mutex);
+    for(unsigned int b=0;b<_buffers.size();++b) {
+      if(!_buffers[b]->fence && !_buffers[b]->queued) return _buffers[b];
+    }
+  }
+
+  // mapped buffers stay with the writer until written: as many as frames in
+  // flight and in the queue. Copied ones are free again once collected
+  const bool persistent = bufferStorage();
+  if(_buffers.size()>=(persistent ? _nbBuffers+_maxQueued : _nbBuffers)) {
+    return NULL;
+  }
+
+  Buffer *buffer = new Buffer();
+  buffer->fence  = 0;
+  buffer->number = 0;
+  buffer->mapped = NULL;
+  buffer->queued = false;
+
+  glGenBuffers(1,&buffer->pbo);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,buffer->pbo);
+  if(persistent) {
+    // immutable storage mapped once, read in place by the writer thread
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_PIXEL_PACK_BUFFER,size,NULL,flags | GL_CLIENT_STORAGE_BIT);
+    buffer->mapped = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER,0,size,flags);
+    if(!buffer->mapped) {
+      cout << "Warning: persistent capture buffer not mapped!" << endl;
+    }
+  } else {
+    glBufferData(GL_PIXEL_PACK_BUFFER,size,NULL,GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+
+  _buffers.push_back(buffer);
+  return buffer;
+}
+
+void FrameCapture::collect(Buffer *buffer) {
+  // done for a frame or more: the GPU is more than nbBuffers-1 frames late otherwise
+  if(glClientWaitSync(buffer->fence,0,0)==GL_TIMEOUT_EXPIRED) {
+    _session->stalls++;
+    while(glClientWaitSync(buffer->fence,GL_SYNC_FLUSH_COMMANDS_BIT,1000000)==GL_TIMEOUT_EXPIRED) {}
+  }
+  glDeleteSync(buffer->fence);
+  buffer->fence = 0;
+
+  Frame *frame = newFrame(false);
+  if(!frame) {
+    _session->dropped++;
+    return;
+  }
+  frame->session = _session;
+  frame->buffer  = buffer->mapped ? buffer : NULL;
+  frame->width   = _width;
+  frame->height  = _height;
+  frame->number  = buffer->number;
+  frame->last    = false;
+
+  // without a persistent mapping, a copy (the buffer is read into again)
+  bool read = true;
+  if(!buffer->mapped) {
+    const size_t size = (size_t)_width*_height*4;
+    frame->pixels.resize(size);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER,buffer->pbo);
+    const void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER,0,size,GL_MAP_READ_BIT);
+    if(data) {
+      memcpy(&frame->pixels[0],data,size);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+    read = data!=NULL;
+  }
+
+  QMutexLocker locker(&_mutex);
+  if(read) {
+    buffer->queued = frame->buffer!=NULL;
+    _queue.push_back(frame);
+    _wake.wakeOne();
+  } else {
+    _free.push_back(frame);
+    _session->dropped++;
+  }
+}
+
+FrameCapture::Frame *FrameCapture::newFrame(bool force) {
+  QMutexLocker locker(&_mutex);
+  if(!_free.empty()) {
+    Frame *frame = _free.back();
+    _free.pop_back();
+    return frame;
+  }
+
+  if(!force && _allocated>=_maxQueued) {
+    return NULL;
+  }
+  _allocated++;
+  return new Frame();
+}
+
+void FrameCapture::release() {
+  vector<Buffer *> done;
+  {
+    QMutexLocker locker(&_mutex);
+    for(unsigned int b=0;b<_retired.size();) {
+      if(_retired[b]->queued) {
+        ++b;
+      } else {
+        done.push_back(_retired[b]);
+        _retired.erase(_retired.begin()+b);
+      }
+    }
+  }
+
+  for(unsigned int b=0;b<done.size();++b) {
+    if(done[b]->mapped) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER,done[b]->pbo);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+    }
+    glDeleteBuffers(1,&done[b]->pbo);
+    delete done[b];
+  }
+}
+
+void FrameCapture::work() {
+  Profiler::setThreadName("capture writer");
+
+  for(;;) {
+    Frame *frame;
+    {
+      QMutexLocker locker(&_mutex);
+      while(!_quit && _queue.empty())
+        _wake.wait(&_mutex);
+      if(_queue.empty())
+        return;
+
+      frame = _queue.front();
+      _queue.pop_front();
+    }
+
+    if(frame->last) {
+      finish(frame->session);
+    } else {
+      write(*frame);
+      frame->session->written++;
+    }
+
+    // the buffer can be read into again
+    QMutexLocker locker(&_mutex);
+    if(frame->buffer) {
+      frame->buffer->queued = false;
+    }
+    _free.push_back(frame);
+  }
+}
+
+void FrameCapture::finish(Session *session) {
+  if(session->video.is_open()) {
+    session->video.close();
+  }
+
+  cout << session->written << " frames written to " << session->filename << " (" << session->dropped << " dropped, "
+       << session->stalls << " waited for)" << endl;
+  delete session;
+}
+
+void FrameCapture::write(const Frame &frame) {
+  PROFILE_ZONE("FrameCapture::write");
+
+  const int w = frame.width, h = frame.height;
+  const unsigned char *pixels = frame.buffer ? frame.buffer->mapped : &frame.pixels[0];
+  Session &session = *frame.session;
+
+  if(session.format==PNG) {
+    // (rows are bottom-up)
+    const QImage image(pixels,w,h,w*4,QImage::Format_RGBX8888);
+    const string name = sequenceName(session.filename,frame.number);
+    if(!image.mirrored().save(QString::fromStdString(name),"PNG")) {
+      cout << "Warning: cannot write " << name << endl;
+    }
+    return;
+  }
+
+  if(session.format==PPM) {
+    _converted.resize((size_t)w*h*3);
+    for(int y=0;y<h;++y) {
+      const unsigned char *src = pixels+(size_t)(h-1-y)*w*4;
+      unsigned char *dst = &_converted[(size_t)y*w*3];
+      for(int x=0;x<w;++x) {
+        dst[3*x  ] = src[4*x  ];
+        dst[3*x+1] = src[4*x+1];
+        dst[3*x+2] = src[4*x+2];
+      }
+    }
+
+    const string name = sequenceName(session.filename,frame.number);
+    ofstream file(name.c_str(),ios::binary);
+    if(!file.is_open()) {
+      cout << "Warning: cannot write " << name << endl;
+      return;
+    }
+    file << "P6\n" << w << " " << h << "\n255\n";
+    file.write((const char *)&_converted[0],_converted.size());
+    return;
+  }
+
+  // Y4M: full range BT.601 (C420jpeg), chroma of each 2x2 block
+  if(session.written==0) {
+    session.video << "YUV4MPEG2 W" << w << " H" << h << " F" << (int)(session.fps*1000.0f+0.5f) << ":1000 Ip A1:1 C420jpeg\n";
+  }
+
+  const int cw = (w+1)/2, ch = (h+1)/2;
+  _converted.resize((size_t)w*h+2*(size_t)cw*ch);
+  unsigned char *luma = &_converted[0];
+  unsigned char *cb = luma+(size_t)w*h;
+  unsigned char *cr = cb+(size_t)cw*ch;
+
+  for(int y=0;y<h;++y) {
+    const unsigned char *src = pixels+(size_t)(h-1-y)*w*4;
+    for(int x=0;x<w;++x) {
+      luma[(size_t)y*w+x] = (unsigned char)((77*src[4*x]+150*src[4*x+1]+29*src[4*x+2]+128)>>8);
+    }
+  }
+
+  for(int v=0;v<ch;++v) {
+    for(int u=0;u<cw;++u) {
+      int r = 0, g = 0, b = 0, n = 0;
+      for(int y=2*v;y<min(2*v+2,h);++y) {
+        const unsigned char *src = pixels+(size_t)(h-1-y)*w*4;
+        for(int x=2*u;x<min(2*u+2,w);++x) {
+          r += src[4*x]; g += src[4*x+1]; b += src[4*x+2]; n++;
+        }
+      }
+      r /= n; g /= n; b /= n;
+      cb[(size_t)v*cw+u] = (unsigned char)min((-43*r-85*g+128*b+32896)>>8,255);
+      cr[(size_t)v*cw+u] = (unsigned char)min((128*r-107*g-21*b+32896)>>8,255);
+    }
+  }
+
+  session.video << "FRAME\n";
+  session.video.write((const char *)&_converted[0],_converted.size());
+}
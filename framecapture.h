@@ -0,0 +1,127 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+// GLEW lib: needs to be included first!!
+#include <GL/glew.h>
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Frames of the backbuffer recorded without stalling the pipeline: each
+// frame is read into a pixel pack buffer (an asynchronous copy, fenced),
+// and the buffer of frame N-(nbBuffers-1) is collected while frame N
+// renders, when the GPU is long done with it. With ARB_buffer_storage the
+// buffers stay mapped (persistent, coherent): the writer thread reads the
+// pixels in place and the buffer is read into again once written.
+// Otherwise they are copied out of a mapping for the writer. The writer
+// encodes and writes them: a Y4M video (4:2:0, "name.y4m") or a numbered
+// image sequence ("name.ppm" or "name.png" give name-000000.ppm...).
+// Frames are dropped (never waited for) when the writer falls more than
+// maxQueued behind. stop() never waits for the writer either: it queues
+// the end of the capture, the writer closes the file after its frames.
+class FrameCapture {
+ public:
+  FrameCapture(unsigned int nbBuffers=3,unsigned int maxQueued=32);
+
+  // (waits for the writer: the GL context must be current)
+  ~FrameCapture();
+
+  // start a capture (no GL: the buffers are allocated with the first frame,
+  // whose size is kept until stop). fps: frame rate of the video
+  bool start(const std::string &filename,float fps=60.0f);
+
+  // read the color of a finished frame (render thread, after its last pass)
+  void readback(GLuint fbo,int width,int height);
+
+  // read the frames in flight and end the capture (the writer closes the
+  // file and prints a summary once they are written)
+  void stop();
+
+  inline bool capturing() const {return _session!=NULL;}
+
+ private:
+  enum Format {Y4M,PPM,PNG};
+
+  // a capture, from start to stop (ended by the writer)
+  struct Session {
+    std::string   filename;
+    Format        format;
+    float         fps;
+    std::ofstream video;
+    unsigned int  stalls;  // frames waited for (render thread until stop)
+    unsigned int  dropped; // frames lost (writer too late)
+    unsigned int  written; // writer thread
+  };
+
+  struct Buffer {
+    GLuint               pbo;
+    GLsync               fence;   // in flight
+    unsigned int         number;
+    const unsigned char *mapped;  // persistent mapping (NULL: copied)
+    bool                 queued;  // read by the writer (shared)
+  };
+
+  struct Frame {
+    Session                   *session;
+    Buffer                    *buffer; // pixels read in its mapping (NULL: copied)
+    std::vector<unsigned char> pixels; // RGBA, bottom-up
+    int          width,height;
+    unsigned int number;
+    bool         last;                 // end of the session
+  };
+
+  class Writer : public QThread {
+   public:
+    Writer(FrameCapture *capture) : _capture(capture) {}
+   protected:
+    virtual void run() {_capture->work();}
+   private:
+    FrameCapture *_capture;
+  };
+
+  // a buffer neither in flight nor queued (a new one while under the limit)
+  Buffer *freeBuffer(GLsizeiptr size);
+
+  // queue a read frame for the writer (waits for its fence if needed)
+  void collect(Buffer *buffer);
+
+  // a frame of the pool (NULL when the writer is too late, unless forced)
+  Frame *newFrame(bool force);
+
+  // delete the buffers of the previous captures the writer is done with
+  void release();
+
+  void work();
+  void write(const Frame &frame);
+  void finish(Session *session);
+
+  unsigned int _nbBuffers;
+  unsigned int _maxQueued;
+
+  // render thread
+  Session             *_session;  // NULL: not capturing
+  int                  _width,_height;
+  unsigned int         _number;   // frames read
+  std::vector<Buffer *> _buffers; // of this capture
+  std::deque<Buffer *>  _inFlight;
+  std::vector<Buffer *> _retired; // of the previous ones
+
+  // shared with the writer
+  Writer               _writer;
+  QMutex               _mutex;
+  QWaitCondition       _wake;
+  bool                 _quit;
+  unsigned int         _allocated; // frames of the queue and the pool
+  std::deque<Frame *>  _queue;
+  std::vector<Frame *> _free;
+
+  // writer thread
+  std::vector<unsigned char> _converted;
+};
+
+#endif // FRAMECAPTURE_H
@@ -0,0 +1,155 @@
+#include "framescheduler.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// the end of a wait is spun (timer wake-ups are not more precise than this)
+static const chrono::microseconds SPIN_MARGIN(1500);
+
+// number of intervals kept for the statistics
+static const unsigned int HISTORY = 120;
+
+FrameScheduler::FrameScheduler(QObject *parent) :
+  QObject(parent),
+  _timer(new QTimer(this)),
+  _mode(VSYNC),
+  _fps(60.0f),
+  _running(false),
+  _continuous(false),
+  _requested(false),
+  _idle(true),
+  _drawing(false),
+  _asynchronous(false),
+  _nextInterval(0),
+  _late(0) {
+
+  _timer->setSingleShot(true);
+  _timer->setTimerType(Qt::PreciseTimer);
+  connect(_timer,SIGNAL(timeout()),this,SLOT(wake()));
+}
+
+void FrameScheduler::setMode(Mode mode,float fps) {
+  _mode = mode;
+  _fps  = max(fps,1.0f);
+  _idle = true;
+  schedule();
+}
+
+void FrameScheduler::setContinuous(bool continuous) {
+  _continuous = continuous;
+  schedule();
+}
+
+void FrameScheduler::start() {
+  _running = true;
+  _drawing = false;
+  _idle = true;
+  schedule();
+}
+
+void FrameScheduler::stop() {
+  _running = false;
+  _timer->stop();
+}
+
+void FrameScheduler::requestFrame() {
+  _requested = true;
+  schedule();
+}
+
+FrameScheduler::Intervals FrameScheduler::intervals() const {
+  Intervals stats;
+  stats.mean = stats.p95 = stats.max = 0.0f;
+  stats.late = _late;
+
+  if(_intervals.empty())
+    return stats;
+
+  vector<float> d(_intervals);
+  for(unsigned int i=0;i<d.size();++i) stats.mean += d[i];
+  stats.mean /= (float)d.size();
+
+  sort(d.begin(),d.end());
+  stats.p95 = d[(d.size()-1)*95/100];
+  stats.max = d.back();
+  return stats;
+}
+
+void FrameScheduler::schedule() {
+  // the frame being drawn schedules the next one when it is done
+  if(!_running || _drawing)
+    return;
+
+  if(!_continuous && !_requested) {
+    _timer->stop();
+    _idle = true;
+    return;
+  }
+
+  if(_mode==VSYNC) {
+    _timer->start(0);
+    return;
+  }
+
+  // after an idle time, the deadlines restart now
+  const Clock::time_point now = Clock::now();
+  if(_idle) {
+    _next = now;
+  }
+
+  // sleep in the event loop until the spin margin
+  const Clock::duration wait = _next-now-SPIN_MARGIN;
+  _timer->start(wait>Clock::duration::zero() ? (int)chrono::duration_cast<chrono::milliseconds>(wait).count() : 0);
+}
+
+void FrameScheduler::wake() {
+  if(!_running)
+    return;
+
+  const chrono::duration<float,milli> period(1000.0f/_fps);
+  Clock::time_point now = Clock::now();
+
+  if(_mode==TARGET_FPS) {
+    // spin the end of the wait
+    while(now<_next) {
+      now = Clock::now();
+    }
+
+    // late: the deadlines restart from this frame
+    if(!_idle && now-_next>period/2.0f) {
+      _late++;
+      _next = now;
+    }
+    _next += chrono::duration_cast<Clock::duration>(period);
+  }
+
+  // interval since the previous frame (not across an idle time)
+  if(!_idle) {
+    const float interval = chrono::duration<float,milli>(now-_last).count();
+    if(_intervals.size()<HISTORY) {
+      _intervals.push_back(interval);
+    } else {
+      _intervals[_nextInterval] = interval;
+    }
+    _nextInterval = (_nextInterval+1)%HISTORY;
+  }
+  _last = now;
+  _idle = false;
+
+  _requested = false;
+  _drawing = true;
+  emit frame();
+
+  if(!_asynchronous) {
+    frameDone();
+  }
+}
+
+void FrameScheduler::frameDone() {
+  if(!_drawing)
+    return;
+
+  _drawing = false;
+  schedule();
+}
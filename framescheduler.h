@@ -0,0 +1,88 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <chrono>
+#include <vector>
+
+// Decides when the next frame is drawn (frame() signal), instead of a
+// redraw timer firing as fast as the event loop allows.
+// - VSYNC: a frame is started as soon as the previous one is done, the
+//   buffer swap (swap interval 1) paces them;
+// - TARGET_FPS: frames start on a fixed period; the event loop sleeps
+//   until shortly before the deadline, then the last SPIN_MARGIN is spun
+//   for precision. A frame starting more than half a period late is
+//   counted and the deadlines restart from it (no burst to catch up).
+// When nothing changes (not continuous and no request), no frame is drawn
+// at all: the CPU use follows the work to do.
+// Frames drawn by another thread are asynchronous: the next frame is only
+// scheduled once frameDone() is called (queued) by that thread.
+class FrameScheduler : public QObject {
+  Q_OBJECT
+
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  enum Mode {VSYNC=0, TARGET_FPS=1};
+
+  // intervals between the starts of the last frames (ms)
+  struct Intervals {
+    float        mean;
+    float        p95;
+    float        max;
+    unsigned int late; // frames started more than half a period late (total)
+  };
+
+  FrameScheduler(QObject *parent=NULL);
+
+  void setMode(Mode mode,float fps=60.0f);
+  inline Mode  mode() const {return _mode;}
+  inline float fps()  const {return _fps;}
+
+  // frame() only starts the frame, frameDone() ends it
+  inline void setAsynchronous(bool asynchronous) {_asynchronous = asynchronous;}
+
+  void start();
+  void stop();
+
+  Intervals intervals() const;
+
+ public slots:
+  // draw a frame at the next deadline (input, settings changes...)
+  void requestFrame();
+
+  // redraw at every period (animation) or only on request
+  void setContinuous(bool continuous);
+
+  // the asynchronous frame is done
+  void frameDone();
+
+ signals:
+  void frame();
+
+ private slots:
+  void wake();
+
+ private:
+  void schedule();
+
+  QTimer *_timer;  // single shot, precise
+  Mode    _mode;
+  float   _fps;
+  bool    _running;
+  bool    _continuous;
+  bool    _requested;
+  bool    _idle;     // no frame since the last deadline: the next one starts fresh
+  bool    _drawing;  // inside frame(): requests are handled by schedule()
+  bool    _asynchronous;
+
+  Clock::time_point _next; // deadline of the next frame
+  Clock::time_point _last; // start of the last frame
+
+  std::vector<float> _intervals; // ring of the last intervals
+  unsigned int       _nextInterval;
+  unsigned int       _late;
+};
+
+#endif // FRAMESCHEDULER_H
@@ -0,0 +1,207 @@
+#include "gputimer.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+GpuTimer::GpuTimer(unsigned int nbFrames,unsigned int history) :
+  _supported(GLEW_VERSION_3_3 || GLEW_ARB_timer_query),
+  _history(history),
+  _frames(nbFrames),
+  _current(0),
+  _number(0),
+  _dropped(0),
+  _lastFrame(0),
+  _lastFrameTime(0.0f),
+  _running(false) {
+
+  for(unsigned int f=0;f<_frames.size();++f) {
+    _frames[f].used    = 0;
+    _frames[f].number  = 0;
+    _frames[f].pending = false;
+  }
+
+  if(!_supported) {
+    cout << "Warning: no timer queries, GPU timings disabled" << endl;
+  }
+}
+
+GpuTimer::~GpuTimer() {
+  for(unsigned int f=0;f<_frames.size();++f) {
+    if(!_frames[f].queries.empty()) {
+      glDeleteQueries((GLsizei)_frames[f].queries.size(),&_frames[f].queries[0]);
+    }
+  }
+}
+
+void GpuTimer::beginFrame() {
+  if(!_supported) return;
+
+  // oldest frames first: the results of a frame are not available before the ones of the previous frame
+  const unsigned int nbFrames = (unsigned int)_frames.size();
+  for(unsigned int k=1;k<=nbFrames;++k) {
+    if(!collect(_frames[(_current+k)%nbFrames])) break;
+  }
+
+  _current = (_current+1)%nbFrames;
+  _number++;
+
+  // GPU more than nbFrames late: the queries are reused without their results
+  Frame &frame = _frames[_current];
+  if(frame.pending) {
+    _dropped++;
+  }
+  frame.used    = 0;
+  frame.number  = _number;
+  frame.pending = false;
+  frame.passes.clear();
+}
+
+void GpuTimer::endFrame() {
+  if(!_supported) return;
+
+  if(_running) end();
+  _frames[_current].pending = _frames[_current].used>0;
+}
+
+void GpuTimer::begin(const string &name) {
+  if(!_supported) return;
+
+  if(_running) end();
+
+  Frame &frame = _frames[_current];
+  if(frame.used==frame.queries.size()) {
+    GLuint query;
+    glGenQueries(1,&query);
+    frame.queries.push_back(query);
+  }
+
+  frame.passes.push_back(pass(name));
+  glBeginQuery(GL_TIME_ELAPSED,frame.queries[frame.used++]);
+  _running = true;
+}
+
+void GpuTimer::end() {
+  if(!_supported || !_running) return;
+
+  glEndQuery(GL_TIME_ELAPSED);
+  _running = false;
+}
+
+vector<GpuTimer::Stats> GpuTimer::stats() const {
+  vector<Stats> stats;
+
+  for(unsigned int p=0;p<_passes.size();++p) {
+    vector<float> d(_passes[p].history);
+
+    Stats s;
+    s.name = _passes[p].name;
+    s.last = _passes[p].last;
+    s.mean = s.p50 = s.p95 = s.p99 = 0.0f;
+
+    if(!d.empty()) {
+      for(unsigned int i=0;i<d.size();++i) s.mean += d[i];
+      s.mean /= (float)d.size();
+
+      sort(d.begin(),d.end());
+      s.p50 = d[(d.size()-1)*50/100];
+      s.p95 = d[(d.size()-1)*95/100];
+      s.p99 = d[(d.size()-1)*99/100];
+    }
+
+    stats.push_back(s);
+  }
+
+  return stats;
+}
+
+float GpuTimer::lastFrameTime(const string &pass) const {
+  map<string,int>::const_iterator it = _indices.find(pass);
+  if(it==_indices.end() || it->second>=(int)_lastPassTimes.size()) {
+    return 0.0f;
+  }
+  return _lastPassTimes[it->second];
+}
+
+vector<float> GpuTimer::history(unsigned int pass) const {
+  const Pass &p = _passes[pass];
+  if(p.history.size()<_history) {
+    return p.history;
+  }
+
+  vector<float> d(p.history.begin()+p.next,p.history.end());
+  d.insert(d.end(),p.history.begin(),p.history.begin()+p.next);
+  return d;
+}
+
+bool GpuTimer::startLog(const string &filename) {
+  stopLog();
+
+  _log.open(filename.c_str());
+  if(!_log.is_open()) {
+    cout << "Warning: cannot write " << filename << endl;
+    return false;
+  }
+
+  _log << "frame,pass,ms" << endl;
+  return true;
+}
+
+void GpuTimer::stopLog() {
+  if(_log.is_open()) {
+    _log.close();
+  }
+}
+
+bool GpuTimer::collect(Frame &frame) {
+  if(!frame.pending) return true;
+
+  // the queries of a frame end in order: the last one is the last available
+  GLint available = 0;
+  glGetQueryObjectiv(frame.queries[frame.used-1],GL_QUERY_RESULT_AVAILABLE,&available);
+  if(!available) return false;
+
+  _lastFrame = frame.number;
+  _lastFrameTime = 0.0f;
+  _lastPassTimes.assign(_passes.size(),0.0f);
+
+  for(unsigned int q=0;q<frame.used;++q) {
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(frame.queries[q],GL_QUERY_RESULT,&ns);
+
+    Pass &p = _passes[frame.passes[q]];
+    p.last = (float)ns*1e-6f;
+    if(p.history.size()<_history) {
+      p.history.push_back(p.last);
+    } else {
+      p.history[p.next] = p.last;
+    }
+    p.next = (p.next+1)%_history;
+
+    _lastFrameTime += p.last;
+    _lastPassTimes[frame.passes[q]] += p.last;
+
+    if(_log.is_open()) {
+      _log << frame.number << "," << p.name << "," << p.last << "\n";
+    }
+  }
+
+  frame.pending = false;
+  return true;
+}
+
+int GpuTimer::pass(const string &name) {
+  map<string,int>::iterator it = _indices.find(name);
+  if(it!=_indices.end()) {
+    return it->second;
+  }
+
+  Pass p;
+  p.name = name;
+  p.next = 0;
+  p.last = 0.0f;
+  _passes.push_back(p);
+
+  return _indices[name] = (int)_passes.size()-1;
+}
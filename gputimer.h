@@ -0,0 +1,98 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+// GLEW lib: needs to be included first!!
+#include <GL/glew.h>
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// GPU duration of the passes of each frame, measured with GL_TIME_ELAPSED
+// queries. Each frame in flight has its own set of queries, read back a few
+// frames later once the GPU reports them as available: timing never waits
+// for the GPU (a frame whose results are still pending when its set is
+// reused is dropped). The durations of the last frames give a rolling mean
+// and percentiles per pass, and can be logged in a CSV file.
+class GpuTimer {
+ public:
+  // durations in milliseconds, over the history
+  struct Stats {
+    std::string name;
+    float last;
+    float mean;
+    float p50;
+    float p95;
+    float p99;
+  };
+
+  GpuTimer(unsigned int nbFrames=4,unsigned int history=120);
+  ~GpuTimer();
+
+  // read back the finished frames / close the current one
+  void beginFrame();
+  void endFrame();
+
+  // time a pass (not nested)
+  void begin(const std::string &name);
+  void end();
+
+  // one entry per pass, in order of first appearance
+  std::vector<Stats> stats() const;
+
+  // last durations of a pass (ms, oldest first)
+  std::vector<float> history(unsigned int pass) const;
+
+  // CSV log of every collected duration (frame,pass,ms)
+  bool startLog(const std::string &filename);
+  void stopLog();
+  inline bool logging() const {return _log.is_open();}
+
+  inline bool supported() const {return _supported;}
+  inline unsigned int droppedFrames() const {return _dropped;}
+
+  // last collected frame: its number (0: none yet), its total GPU time and
+  // the time of one of its passes (0 if not executed), in ms
+  inline unsigned int lastFrame() const {return _lastFrame;}
+  inline float lastFrameTime() const {return _lastFrameTime;}
+  float lastFrameTime(const std::string &pass) const;
+
+ private:
+  struct Frame {
+    std::vector<GLuint> queries;
+    std::vector<int>    passes;  // pass of each used query
+    unsigned int        used;
+    unsigned int        number;
+    bool                pending;
+  };
+
+  struct Pass {
+    std::string        name;
+    std::vector<float> history; // ring of the last durations
+    unsigned int       next;
+    float              last;
+  };
+
+  bool collect(Frame &frame);
+  int  pass(const std::string &name);
+
+  bool         _supported;
+  unsigned int _history;
+
+  std::vector<Frame> _frames;
+  unsigned int       _current;
+  unsigned int       _number;
+  unsigned int       _dropped;
+  unsigned int       _lastFrame;
+  float              _lastFrameTime;
+  std::vector<float> _lastPassTimes; // per pass, in the last collected frame
+  bool               _running;  // a query is active
+
+  std::vector<Pass>          _passes;
+  std::map<std::string,int>  _indices;
+
+  std::ofstream _log;
+};
+
+#endif // GPUTIMER_H
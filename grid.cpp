@@ -1,13 +1,16 @@
 #include "grid.h"
+#include "profiler.h"
 
 using namespace std; 
 
 Grid::Grid(unsigned int size,float minval,float maxval) {
+  PROFILE_ZONE("Grid::Grid");
   const float w = maxval-minval;
   const float h = w;
 
-  const float stepW  = w/(float)size;
-  const float stepH  = h/(float)size;
+  // size vertices per side, the last one on maxval (shared with the next tile)
+  const float stepW  = w/(float)(size-1);
+  const float stepH  = h/(float)(size-1);
   const float startx = minval;
   const float starty = minval;
 
@@ -0,0 +1,199 @@
+#include "heightpyramid.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+MinMaxPyramid::MinMaxPyramid() :
+  _resol(0) {
+
+}
+
+void MinMaxPyramid::build(const float *heights,unsigned int resol) {
+  _resol = resol;
+  _levels.clear();
+
+  // level 0 from the heights
+  unsigned int s = resol/2;
+  _levels.push_back(std::vector<float>(s*s*2));
+  for(unsigned int y=0;y<s;++y) {
+    for(unsigned int x=0;x<s;++x) {
+      const float *h0 = heights+(2*y  )*resol+2*x;
+      const float *h1 = heights+(2*y+1)*resol+2*x;
+      float *d = &_levels[0][(y*s+x)*2];
+      d[0] = std::min(std::min(h0[0],h0[1]),std::min(h1[0],h1[1]));
+      d[1] = std::max(std::max(h0[0],h0[1]),std::max(h1[0],h1[1]));
+    }
+  }
+
+  // next levels from the previous ones
+  while(s>1) {
+    const std::vector<float> &src = _levels.back();
+    const unsigned int ps = s;
+    s = s/2;
+
+    std::vector<float> dst(s*s*2);
+    for(unsigned int y=0;y<s;++y) {
+      for(unsigned int x=0;x<s;++x) {
+        const float *a = &src[((2*y  )*ps+2*x)*2];
+        const float *b = &src[((2*y+1)*ps+2*x)*2];
+        dst[(y*s+x)*2  ] = std::min(std::min(a[0],a[2]),std::min(b[0],b[2]));
+        dst[(y*s+x)*2+1] = std::max(std::max(a[1],a[3]),std::max(b[1],b[3]));
+      }
+    }
+    _levels.push_back(dst);
+  }
+}
+
+void MinMaxPyramid::bounds(unsigned int level,unsigned int x,unsigned int y,float &hmin,float &hmax) const {
+  const unsigned int s = size(level);
+  hmin = _levels[level][(y*s+x)*2  ];
+  hmax = _levels[level][(y*s+x)*2+1];
+}
+
+HeightPyramid::HeightPyramid(unsigned int nbLayers,unsigned int resol) :
+  _nbLayers(nbLayers),
+  _resol(resol),
+  _nbLevels(0),
+  _coarseLevel(0),
+  _fence(0),
+  _changed(false),
+  _versions(nbLayers,0),
+  _readVersions(nbLayers,0),
+  _known(nbLayers,false),
+  _coarse(nbLayers*COARSE*COARSE*2,0.0f),
+  _tileBounds(nbLayers*2,0.0f) {
+
+  for(unsigned int s=_resol/2;s>=1;s/=2) {
+    if(s==COARSE) _coarseLevel = _nbLevels;
+    _nbLevels++;
+  }
+
+  // min (r) and max (g) heights of each level of each layer
+  glGenTextures(1,&_texMinMax);
+  glBindTexture(GL_TEXTURE_2D_ARRAY,_texMinMax);
+  for(unsigned int l=0;l<_nbLevels;++l) {
+    const unsigned int s = (_resol/2)>>l;
+    glTexImage3D(GL_TEXTURE_2D_ARRAY,l,GL_RG32F,s,s,_nbLayers,0,GL_RG,GL_FLOAT,NULL);
+  }
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAX_LEVEL,_nbLevels-1);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MIN_FILTER,GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D_ARRAY,0);
+
+  glGenFramebuffers(1,&_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER,_fbo);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,_texMinMax,0,0);
+  glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+  if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    cout << "Warning: min/max FBO not complete!" << endl;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER,0);
+
+  // pixel buffer receiving the coarse level of all layers
+  glGenBuffers(1,&_pbo);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,_pbo);
+  glBufferData(GL_PIXEL_PACK_BUFFER,_coarse.size()*sizeof(float),NULL,GL_STREAM_READ);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+}
+
+HeightPyramid::~HeightPyramid() {
+  if(_fence) glDeleteSync(_fence);
+  glDeleteBuffers(1,&_pbo);
+  glDeleteFramebuffers(1,&_fbo);
+  glDeleteTextures(1,&_texMinMax);
+}
+
+unsigned int HeightPyramid::bindLevel(int layer,unsigned int level) {
+  // (level 0 reads the height map: the coarsest level is exposed instead)
+  const GLint source = level>0 ? (GLint)level-1 : (GLint)_nbLevels-1;
+  glBindTexture(GL_TEXTURE_2D_ARRAY,_texMinMax);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_BASE_LEVEL,source);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAX_LEVEL,source);
+
+  glBindFramebuffer(GL_FRAMEBUFFER,_fbo);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,_texMinMax,level,layer);
+  return (_resol/2)>>level;
+}
+
+void HeightPyramid::restoreLevels() {
+  glBindTexture(GL_TEXTURE_2D_ARRAY,_texMinMax);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_BASE_LEVEL,0);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAX_LEVEL,_nbLevels-1);
+  glBindTexture(GL_TEXTURE_2D_ARRAY,0);
+}
+
+void HeightPyramid::invalidate(int layer) {
+  _versions[layer]++;
+  _known[layer] = false;
+  _changed = true;
+}
+
+void HeightPyramid::readback() {
+  // collect the pending transfer if the GPU is done with it
+  if(_fence) {
+    const GLenum status = glClientWaitSync(_fence,0,0);
+    if(status!=GL_ALREADY_SIGNALED && status!=GL_CONDITION_SATISFIED)
+      return;
+
+    glDeleteSync(_fence);
+    _fence = 0;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER,_pbo);
+    const float *data = (const float *)glMapBufferRange(GL_PIXEL_PACK_BUFFER,0,_coarse.size()*sizeof(float),GL_MAP_READ_BIT);
+    if(data) {
+      const unsigned int n = COARSE*COARSE*2;
+      for(unsigned int l=0;l<_nbLayers;++l) {
+        // the layer may have been rebuilt since the transfer started
+        if(_readVersions[l]!=_versions[l]) continue;
+
+        memcpy(&_coarse[l*n],data+l*n,n*sizeof(float));
+        _tileBounds[2*l  ] = _coarse[l*n];
+        _tileBounds[2*l+1] = _coarse[l*n+1];
+        for(unsigned int k=1;k<COARSE*COARSE;++k) {
+          _tileBounds[2*l  ] = std::min(_tileBounds[2*l  ],_coarse[l*n+2*k  ]);
+          _tileBounds[2*l+1] = std::max(_tileBounds[2*l+1],_coarse[l*n+2*k+1]);
+        }
+        _known[l] = true;
+      }
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+  }
+
+  // start a new transfer when some chains were rebuilt
+  if(_changed) {
+    _changed = false;
+    _readVersions = _versions;
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY,_texMinMax);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER,_pbo);
+    glGetTexImage(GL_TEXTURE_2D_ARRAY,_coarseLevel,GL_RG,GL_FLOAT,(void *)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY,0);
+
+    _fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+  }
+}
+
+bool HeightPyramid::bounds(int layer,float &hmin,float &hmax) const {
+  if(layer<0 || !_known[layer])
+    return false;
+
+  hmin = _tileBounds[2*layer  ];
+  hmax = _tileBounds[2*layer+1];
+  return true;
+}
+
+const float *HeightPyramid::coarse(int layer) const {
+  if(layer<0 || !_known[layer])
+    return NULL;
+
+  return &_coarse[layer*COARSE*COARSE*2];
+}
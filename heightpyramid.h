@@ -0,0 +1,88 @@
+#ifndef HEIGHTPYRAMID_H
+#define HEIGHTPYRAMID_H
+
+// GLEW lib: needs to be included first!!
+#include <GL/glew.h>
+
+#include <vector>
+
+// Min/max mip chain of a baked height map, built on the CPU.
+// Level 0 is resol/2 (each texel bounds 2x2 heights) down to 1x1,
+// the same layout as the GPU chain of HeightPyramid.
+class MinMaxPyramid {
+ public:
+  MinMaxPyramid();
+
+  // heights: resol*resol values, resol being a power of two
+  void build(const float *heights,unsigned int resol);
+
+  inline unsigned int nbLevels() const {return (unsigned int)_levels.size();}
+  inline unsigned int size(unsigned int level) const {return (_resol/2)>>level;}
+
+  // bounds of texel (x,y) of a level
+  void bounds(unsigned int level,unsigned int x,unsigned int y,float &hmin,float &hmax) const;
+
+ private:
+  unsigned int _resol;
+  std::vector<std::vector<float> > _levels; // interleaved min,max
+};
+
+// Min/max mip chain of every layer of the tile height maps (RG32F array).
+// Chains are rebuilt per layer, and the coarse level is read back
+// asynchronously to give CPU code conservative bounds of the tiles.
+class HeightPyramid {
+ public:
+  // size of the coarse level read back to the CPU
+  static const unsigned int COARSE = 4;
+
+  HeightPyramid(unsigned int nbLayers=32,unsigned int resol=256);
+  ~HeightPyramid();
+
+  // bind the fbo on a level of a layer, returns the level size
+  // (level l is computed from level l-1, level 0 from the height map).
+  // The texture (bound to the active unit) only exposes the source level
+  // l-1 as its level 0: the written level is never in the sampled range
+  unsigned int bindLevel(int layer,unsigned int level);
+
+  // expose the whole chain again, once the levels are written
+  void restoreLevels();
+
+  // the chain of this layer has been rebuilt: its CPU bounds are outdated
+  void invalidate(int layer);
+
+  // collect the finished readback and start a new one if needed (never waits)
+  void readback();
+
+  // bounds of the whole layer / of its coarse texels (COARSE*COARSE min,max pairs);
+  // false/NULL while the readback of the current content is not available
+  bool bounds(int layer,float &hmin,float &hmax) const;
+  const float *coarse(int layer) const;
+
+  // a readback is in flight or has to be started
+  inline bool pending() const {return _fence!=0 || _changed;}
+
+  inline unsigned int nbLevels() const {return _nbLevels;}
+  inline GLuint texture() const {return _texMinMax;}
+
+ private:
+  unsigned int _nbLayers;
+  unsigned int _resol;
+  unsigned int _nbLevels;
+  unsigned int _coarseLevel;
+
+  GLuint _fbo;
+  GLuint _texMinMax;
+
+  // asynchronous readback of the coarse level (all layers at once)
+  GLuint _pbo;
+  GLsync _fence;
+  bool   _changed;
+
+  std::vector<unsigned int> _versions;     // incremented at each rebuild
+  std::vector<unsigned int> _readVersions; // versions of the pending readback
+  std::vector<bool>         _known;        // CPU data matches the current version
+  std::vector<float>        _coarse;
+  std::vector<float>        _tileBounds;
+};
+
+#endif // HEIGHTPYRAMID_H
@@ -0,0 +1,199 @@
+#include "horizonbaker.h"
+#include "profiler.h"
+
+#include <QMutexLocker>
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+// unit steps of the azimuths (counterclockwise from +x)
+static const int AZIMUTHS[HorizonBaker::NB_AZIMUTHS][2] = {
+  { 1, 0}, { 1, 1}, { 0, 1}, {-1, 1}, {-1, 0}, {-1,-1}, { 0,-1}, { 1,-1}
+};
+
+HorizonBaker::HorizonBaker(const NoiseGraph &graph,unsigned int nbLayers,unsigned int resol,float tileSize) :
+  _graph(graph),
+  _nbLayers(nbLayers),
+  _resol(resol),
+  _tileSize(tileSize),
+  _quit(false),
+  _sequence(0),
+  _working(0),
+  _baked(nbLayers,glm::ivec2(0x7fffffff)) {
+
+  // 2 layers per tile: azimuths 0-3 and 4-7 (sines of the horizon elevation)
+  glGenTextures(1,&_texHorizon);
+  glBindTexture(GL_TEXTURE_2D_ARRAY,_texHorizon);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY,0,GL_RGBA8,_resol,_resol,2*_nbLayers,0,GL_RGBA,GL_UNSIGNED_BYTE,NULL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D_ARRAY,0);
+
+  // leave a core to the render thread
+  const int nbThreads = std::max(1,QThread::idealThreadCount()-1);
+  for(int t=0;t<nbThreads;++t) {
+    _workers.push_back(new Worker(this));
+    _workers.back()->start();
+  }
+}
+
+HorizonBaker::~HorizonBaker() {
+  _mutex.lock();
+  _quit = true;
+  _wake.wakeAll();
+  _mutex.unlock();
+
+  for(unsigned int t=0;t<_workers.size();++t) {
+    _workers[t]->wait();
+    delete _workers[t];
+  }
+
+  glDeleteTextures(1,&_texHorizon);
+}
+
+void HorizonBaker::request(int i,int j,int layer,float stamp) {
+  QMutexLocker locker(&_mutex);
+
+  Job &job = _pending[layer];
+  job.i = i;
+  job.j = j;
+  job.stamp = stamp;
+  job.sequence = _sequence++;
+  _wake.wakeOne();
+}
+
+void HorizonBaker::upload() {
+  PROFILE_ZONE("HorizonBaker::upload");
+  std::map<int,Job> done;
+  {
+    QMutexLocker locker(&_mutex);
+    done.swap(_done);
+  }
+
+  if(done.empty())
+    return;
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY,_texHorizon);
+  glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+  for(std::map<int,Job>::const_iterator it=done.begin();it!=done.end();++it) {
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY,0,0,0,2*it->first,_resol,_resol,2,GL_RGBA,GL_UNSIGNED_BYTE,&it->second.data[0]);
+    _baked[it->first] = glm::ivec2(it->second.i,it->second.j);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+  glBindTexture(GL_TEXTURE_2D_ARRAY,0);
+}
+
+bool HorizonBaker::ready(int layer,int i,int j) const {
+  return _baked[layer]==glm::ivec2(i,j);
+}
+
+bool HorizonBaker::busy() {
+  QMutexLocker locker(&_mutex);
+  return !_pending.empty() || !_done.empty() || _working>0;
+}
+
+void HorizonBaker::work() {
+  Profiler::setThreadName("horizon baker");
+
+  for(;;) {
+    int layer;
+    Job job;
+    {
+      QMutexLocker locker(&_mutex);
+      while(!_quit && _pending.empty())
+        _wake.wait(&_mutex);
+      if(_quit)
+        return;
+
+      layer = _pending.begin()->first;
+      job = _pending.begin()->second;
+      _pending.erase(_pending.begin());
+      _working++;
+    }
+
+    bake(_graph,job.i,job.j,job.stamp,_resol,_tileSize,job.data);
+
+    // a bake requested later may have finished first
+    QMutexLocker locker(&_mutex);
+    std::map<int,Job>::const_iterator it = _done.find(layer);
+    if(it==_done.end() || it->second.sequence<job.sequence)
+      _done[layer] = job;
+    _working--;
+  }
+}
+
+void HorizonBaker::bake(const NoiseGraph &graph,int i,int j,float stamp,unsigned int resol,
+                        float tileSize,std::vector<unsigned char> &out) {
+  PROFILE_ZONE("HorizonBaker::bake");
+
+  // heights over the tile and its 8 neighbours (same texel spacing)
+  const int margin = (int)resol-1;
+  const int n = (int)resol+2*margin;
+  const float step = 1.0f/(float)(resol-1);
+
+  std::vector<float> x(n*n), y(n*n), e(n*n);
+  for(int v=0;v<n;++v) {
+    for(int u=0;u<n;++u) {
+      x[v*n+u] = (float)i+(float)(u-margin)*step;
+      y[v*n+u] = (float)j+(float)(v-margin)*step;
+    }
+  }
+  graph.evaluate(&x[0],&y[0],stamp,&e[0],n*n);
+
+  // vertices are displaced by -height: elevation is -h
+  for(int k=0;k<n*n;++k)
+    e[k] = -e[k];
+
+  out.assign(resol*resol*8,0);
+  std::vector<int> hull;    // indices along the line of the upper hull points
+  std::vector<float> line;  // elevations along the line (reused by all the lines)
+
+  for(unsigned int a=0;a<NB_AZIMUTHS;++a) {
+    const int dx = AZIMUTHS[a][0];
+    const int dy = AZIMUTHS[a][1];
+    const float len = step*tileSize*sqrtf((float)(dx*dx+dy*dy));
+    unsigned char *dst = &out[(a/4)*resol*resol*4+(a%4)];
+
+    // each line starts on the farthest point in the direction and walks back
+    for(int v0=0;v0<n;++v0) {
+      for(int u0=0;u0<n;++u0) {
+        const int un = u0+dx, vn = v0+dy;
+        if(un>=0 && un<n && vn>=0 && vn<n)
+          continue;
+
+        hull.clear();
+        line.clear();
+        for(int u=u0,v=v0;u>=0 && u<n && v>=0 && v<n;u-=dx,v-=dy) {
+          const int k = (int)line.size();
+          const float ep = e[v*n+u];
+          line.push_back(ep);
+
+          // drop the hull points hidden behind the next one as seen from here
+          while(hull.size()>=2) {
+            const int q1 = hull[hull.size()-1];
+            const int q2 = hull[hull.size()-2];
+            if((line[q1]-ep)*(float)(k-q2) > (line[q2]-ep)*(float)(k-q1))
+              break;
+            hull.pop_back();
+          }
+
+          const int tu = u-margin, tv = v-margin;
+          if(tu>=0 && tu<(int)resol && tv>=0 && tv<(int)resol) {
+            float s = 0.0f;
+            if(!hull.empty()) {
+              const int q = hull.back();
+              const float t = (line[q]-ep)/((float)(k-q)*len);
+              s = t>0.0f ? t/sqrtf(1.0f+t*t) : 0.0f;
+            }
+            dst[(tv*resol+tu)*4] = (unsigned char)(s*255.0f+0.5f);
+          }
+
+          hull.push_back(k);
+        }
+      }
+    }
+  }
+}
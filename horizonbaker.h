@@ -0,0 +1,91 @@
+#ifndef HORIZONBAKER_H
+#define HORIZONBAKER_H
+
+// GLEW lib: needs to be included first!!
+#include <GL/glew.h>
+
+// OpenGL Mathematics
+#include <glm/glm.hpp>
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <map>
+#include <vector>
+
+#include "noisegraph.h"
+
+// Horizon maps of the terrain tiles, baked on CPU worker threads from the
+// CPU evaluation of the terrain graph. For each texel, the elevation (sine)
+// of the horizon is stored for NB_AZIMUTHS directions: shadows are given by
+// comparing the light elevation to the horizon of its azimuth, and ambient
+// occlusion by the mean horizon. Each tile layer of the TileCache owns 2
+// layers of the RGBA8 array (azimuths 0-3 and 4-7).
+class HorizonBaker {
+ public:
+  static const unsigned int NB_AZIMUTHS = 8;
+
+  HorizonBaker(const NoiseGraph &graph,unsigned int nbLayers=32,unsigned int resol=64,float tileSize=2.0f);
+  ~HorizonBaker();
+
+  // (re)bake tile (i,j) in a tile layer; a pending request of the same layer is replaced
+  void request(int i,int j,int layer,float stamp);
+
+  // upload the finished bakes (main thread, never waits)
+  void upload();
+
+  // the layer holds a bake of tile (i,j) (maybe from another stamp)
+  bool ready(int layer,int i,int j) const;
+
+  // bakes are requested, running or not uploaded yet
+  bool busy();
+
+  inline unsigned int resol() const {return _resol;}
+  inline GLuint texture() const {return _texHorizon;}
+
+  // horizons of tile (i,j): 2 layers of resol*resol RGBA8 texels.
+  // The heights are evaluated over the tile and one tile around it, then
+  // each direction is swept line by line keeping the upper convex hull of the
+  // points ahead, which gives the horizon of every texel in linear time
+  static void bake(const NoiseGraph &graph,int i,int j,float stamp,unsigned int resol,
+                   float tileSize,std::vector<unsigned char> &out);
+
+ private:
+  struct Job {
+    int   i,j;
+    float stamp;
+    unsigned int sequence; // request order
+    std::vector<unsigned char> data;
+  };
+
+  class Worker : public QThread {
+   public:
+    Worker(HorizonBaker *baker) : _baker(baker) {}
+   protected:
+    virtual void run() {_baker->work();}
+   private:
+    HorizonBaker *_baker;
+  };
+
+  void work();
+
+  NoiseGraph   _graph;
+  unsigned int _nbLayers;
+  unsigned int _resol;
+  float        _tileSize;
+
+  std::vector<Worker *> _workers;
+  QMutex                _mutex;
+  QWaitCondition        _wake;
+  bool                  _quit;
+  unsigned int          _sequence;
+  unsigned int          _working;  // jobs being baked
+
+  std::map<int,Job>     _pending; // layer -> request
+  std::map<int,Job>     _done;    // layer -> finished bake
+  std::vector<glm::ivec2> _baked; // tile uploaded in each layer
+
+  GLuint _texHorizon;
+};
+
+#endif // HORIZONBAKER_H
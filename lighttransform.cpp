@@ -0,0 +1,32 @@
+#include "lighttransform.h"
+
+LightTransform::LightTransform() {
+
+  for(int c=0;c<MAX_CASCADES;++c) {
+    _block.lightMvp[c]  = glm::mat4(1.0f);
+    _block.shadowMat[c] = glm::mat4(1.0f);
+  }
+  _block.cascadeSplits = glm::vec4(0.0f);
+  _block.nbCascades = 0;
+  _block.padding[0] = _block.padding[1] = _block.padding[2] = 0;
+}
+
+void LightTransform::setCascade(int cascade,const glm::mat4 &mvp) {
+  // from [-1,1] to [0,1]
+  const glm::mat4 bias(0.5f,0.0f,0.0f,0.0f,
+                       0.0f,0.5f,0.0f,0.0f,
+                       0.0f,0.0f,0.5f,0.0f,
+                       0.5f,0.5f,0.5f,1.0f);
+
+  _block.lightMvp[cascade]  = mvp;
+  _block.shadowMat[cascade] = bias*mvp;
+}
+
+void LightTransform::setSplits(const glm::vec4 &splits,int nbCascades) {
+  _block.cascadeSplits = splits;
+  _block.nbCascades = nbCascades;
+}
+
+void LightTransform::upload(UniformRing &ring) const {
+  ring.bind(BINDING,ring.push(&_block,sizeof(Block)),sizeof(Block));
+}
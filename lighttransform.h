@@ -0,0 +1,52 @@
+#ifndef LIGHTTRANSFORM_H
+#define LIGHTTRANSFORM_H
+
+// GLEW lib: needs to be included first!!
+#include <GL/glew.h>
+
+// OpenGL Mathematics
+#include <glm/glm.hpp>
+
+#include "uniformring.h"
+
+// Light-space transform of the frame, shared by every pass through the
+// "LightTransform" uniform block (std140):
+//   mat4 lightMvp[4];   world to light clip space of each cascade (shadow pass)
+//   mat4 shadowMat[4];  world to [0,1] shadow map space of each cascade (lookups)
+//   vec4 cascadeSplits; far view distance of each cascade
+//   int  nbCascades;
+// The lookup matrices are derived from the ones the cascades are rendered
+// with, so both passes always agree.
+class LightTransform {
+ public:
+  static const int    MAX_CASCADES = 4;
+  static const GLuint BINDING = 0; // uniform buffer binding point
+
+  LightTransform();
+
+  // matrix a cascade is rendered with
+  void setCascade(int cascade,const glm::mat4 &mvp);
+  void setSplits(const glm::vec4 &splits,int nbCascades);
+
+  inline const glm::mat4 &mvp(int cascade) const {return _block.lightMvp[cascade];}
+  inline const glm::mat4 &shadowMatrix(int cascade) const {return _block.shadowMat[cascade];}
+  inline const glm::vec4 &splits() const {return _block.cascadeSplits;}
+  inline int nbCascades() const {return _block.nbCascades;}
+
+  // write the block of this frame in the ring and bind it
+  // (the lookups it gives are checked by tests/lighttransform_test)
+  void upload(UniformRing &ring) const;
+
+ private:
+  struct Block {
+    glm::mat4 lightMvp[MAX_CASCADES];
+    glm::mat4 shadowMat[MAX_CASCADES];
+    glm::vec4 cascadeSplits;
+    GLint     nbCascades;
+    GLint     padding[3];
+  };
+
+  Block _block;
+};
+
+#endif // LIGHTTRANSFORM_H
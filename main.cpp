@@ -2,18 +2,95 @@
 #include <QString>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include "viewer.h"
+#include "profiler.h"
+#ifdef TERRAIN_BENCHMARK
+#include "offscreencontext.h"
+#endif
 
 using namespace std;
 
+#ifdef TERRAIN_BENCHMARK
+// headless benchmark: terrain --benchmark [frames] [--size WxH] [--grid n] [--capture file]
+// (no display needed, prints one JSON line with the timings)
+static int benchmark(int argc,char** argv) {
+  unsigned int frames = 300, width = 1280, height = 720, grid = 64;
+  const char *capture = NULL;
+
+  for(int i=1;i<argc;++i) {
+    if(strcmp(argv[i],"--benchmark")==0 && i+1<argc && argv[i+1][0]!='-') {
+      frames = atoi(argv[++i]);
+    } else if(strcmp(argv[i],"--size")==0 && i+1<argc) {
+      sscanf(argv[++i],"%ux%u",&width,&height);
+    } else if(strcmp(argv[i],"--grid")==0 && i+1<argc) {
+      const int n = atoi(argv[++i]);
+      if(n<4) {
+        // (the shadow grid has half the resolution and needs 2 cells)
+        cerr << "Error: --grid needs a resolution of 4 or more" << endl;
+        return 1;
+      }
+      grid = n;
+    } else if(strcmp(argv[i],"--capture")==0 && i+1<argc) {
+      capture = argv[++i];
+    }
+  }
+
+  // widgets without a display server
+  if(qgetenv("QT_QPA_PLATFORM").isEmpty()) {
+    qputenv("QT_QPA_PLATFORM","offscreen");
+  }
+  QApplication application(argc,argv);
+  Profiler::setThreadName("main");
+
+  OffscreenContext context(3,3);
+  if(!context.valid()) {
+    cerr << "Error: no offscreen OpenGL 3.3 context" << endl;
+    return 1;
+  }
+
+  {
+    // never shown: only the size of the widget is used
+    Viewer viewer(argv[0]);
+    viewer.resize(width,height);
+    viewer.setGridResolution(grid);
+    if(capture) {
+      viewer.startCapture(capture);
+    }
+
+    context.makeCurrent();
+    viewer.benchmark(max(frames,1u));
+  }
+
+  return 0;
+}
+#endif
+
+// window: terrain [--capture file] (file.y4m video, file.ppm or file.png sequence)
 int main(int argc,char** argv) {
+  const char *capture = NULL;
+  for(int i=1;i<argc;++i) {
+    if(strcmp(argv[i],"--benchmark")==0) {
+#ifdef TERRAIN_BENCHMARK
+      return benchmark(argc,argv);
+#else
+      cerr << "Error: built without the benchmark (EGL)" << endl;
+      return 1;
+#endif
+    } else if(strcmp(argv[i],"--capture")==0 && i+1<argc) {
+      capture = argv[++i];
+    }
+  }
+
   QApplication application(argc,argv);
+  Profiler::setThreadName("main");
 
 	QGLFormat fmt;
 	fmt.setVersion(3, 3);
 	fmt.setProfile(QGLFormat::CoreProfile);
 	fmt.setSampleBuffers(true);
+	fmt.setSwapInterval(1); // frames paced by the vertical sync
 	/*
 		S'il y a des problemes de versions de GLSL
 		export MESA_GL_VERSION_OVERRIDE=3.3
@@ -24,6 +101,10 @@ int main(int argc,char** argv) {
 
   viewer.setWindowTitle("Exercice 09 - Terrain rendering");
   viewer.show();
+  viewer.startRendering();
+  if(capture) {
+    viewer.startCapture(capture);
+  }
   
   return application.exec();
 }
@@ -8,8 +8,17 @@ TARGET    = terrain
 LIBS     += -lGLEW -lGL -lGLU -lm
 INCLUDEPATH  += $${GLEW_PATH}/include  $${GLM_PATH}
 
-SOURCES   = shader.cpp grid.cpp trackball.cpp camera.cpp viewer.cpp main.cpp 
-HEADERS   = shader.h grid.h trackball.h camera.h viewer.h
+SOURCES   = shader.cpp grid.cpp trackball.cpp camera.cpp noisegraph.cpp tilecache.cpp heightpyramid.cpp uniformring.cpp lighttransform.cpp horizonbaker.cpp rendergraph.cpp gputimer.cpp profiler.cpp framescheduler.cpp shaderpermutations.cpp dynamicresolution.cpp simulation.cpp renderthread.cpp framecapture.cpp viewer.cpp main.cpp 
+HEADERS   = shader.h grid.h trackball.h camera.h noisegraph.h tilecache.h heightpyramid.h uniformring.h lighttransform.h horizonbaker.h rendergraph.h gputimer.h profiler.h framescheduler.h shaderpermutations.h dynamicresolution.h triplebuffer.h simulation.h renderthread.h framecapture.h viewer.h
 
-CONFIG   += qt opengl warn_on thread uic4 release
+CONFIG   += qt opengl warn_on thread uic4 release c++11
 QT       *= xml opengl core
+
+# headless benchmark (--benchmark): needs EGL (libegl1-mesa-dev),
+# "qmake CONFIG+=no_benchmark" builds the window only
+!no_benchmark {
+  DEFINES  += TERRAIN_BENCHMARK
+  LIBS     += -lEGL
+  SOURCES  += offscreencontext.cpp
+  HEADERS  += offscreencontext.h
+}
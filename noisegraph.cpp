@@ -0,0 +1,368 @@
+#include "noisegraph.h"
+
+#include <math.h>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+using namespace std;
+
+// CPU versions of the noise.frag helpers (must stay in sync with the shader)
+static inline float fract(float x) {
+  return x-floorf(x);
+}
+
+static inline float hashDot(float px,float py,float a,float b) {
+  return -1.0f+2.0f*fract(sinf(px*a+py*b)*43758.5453123f);
+}
+
+static inline float gnoise(float px,float py) {
+  const float ix = floorf(px);
+  const float iy = floorf(py);
+  const float fx = px-ix;
+  const float fy = py-iy;
+
+  const float ux = fx*fx*(3.0f-2.0f*fx);
+  const float uy = fy*fy*(3.0f-2.0f*fy);
+
+  const float n00 = hashDot(ix     ,iy     ,127.1f,311.7f)*fx        + hashDot(ix     ,iy     ,269.5f,183.3f)*fy;
+  const float n10 = hashDot(ix+1.0f,iy     ,127.1f,311.7f)*(fx-1.0f) + hashDot(ix+1.0f,iy     ,269.5f,183.3f)*fy;
+  const float n01 = hashDot(ix     ,iy+1.0f,127.1f,311.7f)*fx        + hashDot(ix     ,iy+1.0f,269.5f,183.3f)*(fy-1.0f);
+  const float n11 = hashDot(ix+1.0f,iy+1.0f,127.1f,311.7f)*(fx-1.0f) + hashDot(ix+1.0f,iy+1.0f,269.5f,183.3f)*(fy-1.0f);
+
+  const float nx0 = n00+(n10-n00)*ux;
+  const float nx1 = n01+(n11-n01)*ux;
+  return nx0+(nx1-nx0)*uy;
+}
+
+// GLSL float literal (always with a decimal point)
+static std::string literal(float v) {
+  std::ostringstream s;
+  s << std::setprecision(8) << v;
+
+  std::string str = s.str();
+  if(str.find_first_of(".e")==std::string::npos)
+    str += ".0";
+  return str;
+}
+
+static std::string reg(int r) {
+  std::ostringstream s;
+  s << "r" << r;
+  return s.str();
+}
+
+NoiseGraph::NoiseGraph() :
+  _output(-1),
+  _nbRegisters(0),
+  _result(-1) {
+
+}
+
+int NoiseGraph::addNode(NodeType type,int in0,int in1,float p0,float p1,float p2,float p3,int octaves) {
+  Node n;
+  n.type      = type;
+  n.inputs[0] = in0;
+  n.inputs[1] = in1;
+  n.params[0] = p0;
+  n.params[1] = p1;
+  n.params[2] = p2;
+  n.params[3] = p3;
+  n.octaves   = octaves;
+
+  _nodes.push_back(n);
+  return (int)_nodes.size()-1;
+}
+
+int NoiseGraph::position() {
+  return addNode(POSITION,-1,-1);
+}
+
+int NoiseGraph::motion() {
+  return addNode(MOTION,-1,-1);
+}
+
+int NoiseGraph::constant(float value) {
+  return addNode(CONSTANT,-1,-1,value);
+}
+
+int NoiseGraph::fbm(int domain,float amplitude,float frequency,float persistence,int nboctaves) {
+  return addNode(FBM,domain,-1,amplitude,frequency,persistence,0.0f,nboctaves);
+}
+
+int NoiseGraph::ridged(int domain,float amplitude,float frequency,float persistence,int nboctaves) {
+  return addNode(RIDGED,domain,-1,amplitude,frequency,persistence,0.0f,nboctaves);
+}
+
+int NoiseGraph::warp(int domain,float strength,float frequency,int nboctaves) {
+  return addNode(WARP,domain,-1,strength,frequency,0.5f,0.0f,nboctaves);
+}
+
+int NoiseGraph::sin(int x,float amplitude,float frequency) {
+  return addNode(SIN,x,-1,amplitude,frequency);
+}
+
+int NoiseGraph::add(int a,int b) {
+  return addNode(ADD,a,b);
+}
+
+int NoiseGraph::mul(int a,int b) {
+  return addNode(MUL,a,b);
+}
+
+int NoiseGraph::scale(int x,float a,float b) {
+  return addNode(SCALE,x,-1,a,b);
+}
+
+void NoiseGraph::setOutput(int node) {
+  _output = node;
+}
+
+void NoiseGraph::emitOctaves(OpCode op,int dst,int src,float amplitude,float frequency,
+                             float persistence,int nboctaves,float ox,float oy) {
+  // unrolled octave loop: each octave gets its own constants
+  float a = amplitude;
+  float f = frequency;
+
+  for(int i=0;i<nboctaves;++i) {
+    Instruction ins = {op,dst,{src,-1},a,f,ox,oy};
+    _program.push_back(ins);
+    f = f*2.0f;
+    a = a*persistence;
+  }
+}
+
+void NoiseGraph::compile() {
+  _program.clear();
+  _nbRegisters = 0;
+  _result = -1;
+
+  if(_output<0 || _output>=(int)_nodes.size())
+    return;
+
+  // keep only the nodes used by the output (inputs always precede their users)
+  std::vector<bool> used(_nodes.size(),false);
+  used[_output] = true;
+  for(int i=_output;i>=0;--i) {
+    if(!used[i]) continue;
+    for(int k=0;k<2;++k) {
+      if(_nodes[i].inputs[k]>=0)
+        used[_nodes[i].inputs[k]] = true;
+    }
+  }
+
+  // one register per scalar, two per vec2
+  std::vector<int> regs(_nodes.size(),-1);
+  for(int i=0;i<=_output;++i) {
+    if(!used[i]) continue;
+
+    const Node &n  = _nodes[i];
+    const int dst  = _nbRegisters;
+    const int src0 = n.inputs[0]>=0 ? regs[n.inputs[0]] : -1;
+    const int src1 = n.inputs[1]>=0 ? regs[n.inputs[1]] : -1;
+
+    regs[i] = dst;
+    _nbRegisters += isVector(n.type) ? 2 : 1;
+
+    switch(n.type) {
+    case POSITION: {
+      Instruction ins = {OP_POSITION,dst,{-1,-1},0,0,0,0};
+      _program.push_back(ins);
+      break;
+    }
+    case MOTION: {
+      Instruction ins = {OP_MOTION,dst,{-1,-1},0,0,0,0};
+      _program.push_back(ins);
+      break;
+    }
+    case CONSTANT: {
+      Instruction ins = {OP_FILL,dst,{-1,-1},n.params[0],0,0,0};
+      _program.push_back(ins);
+      break;
+    }
+    case FBM:
+    case RIDGED: {
+      Instruction ins = {OP_FILL,dst,{-1,-1},0,0,0,0};
+      _program.push_back(ins);
+      emitOctaves(n.type==FBM ? OP_NOISE : OP_RIDGE,dst,src0,
+                  n.params[0],n.params[1],n.params[2],n.octaves);
+      break;
+    }
+    case WARP: {
+      // offset = (fbm(p),fbm(p+(5.2,1.3))), then p+strength*offset
+      Instruction fx = {OP_FILL,dst  ,{-1,-1},0,0,0,0};
+      Instruction fy = {OP_FILL,dst+1,{-1,-1},0,0,0,0};
+      _program.push_back(fx);
+      _program.push_back(fy);
+      emitOctaves(OP_NOISE,dst  ,src0,1.0f,n.params[1],n.params[2],n.octaves);
+      emitOctaves(OP_NOISE,dst+1,src0,1.0f,n.params[1],n.params[2],n.octaves,5.2f,1.3f);
+      Instruction ins = {OP_WARP,dst,{src0,-1},n.params[0],0,0,0};
+      _program.push_back(ins);
+      break;
+    }
+    case SIN: {
+      Instruction ins = {OP_SIN,dst,{src0,-1},n.params[0],n.params[1],0,0};
+      _program.push_back(ins);
+      break;
+    }
+    case ADD:
+    case MUL: {
+      Instruction ins = {n.type==ADD ? OP_ADD : OP_MUL,dst,{src0,src1},0,0,0,0};
+      _program.push_back(ins);
+      break;
+    }
+    case SCALE: {
+      Instruction ins = {OP_SCALE,dst,{src0,-1},n.params[0],n.params[1],0,0};
+      _program.push_back(ins);
+      break;
+    }
+    }
+  }
+
+  _result = regs[_output];
+}
+
+std::string NoiseGraph::glsl() const {
+  std::ostringstream s;
+  std::vector<bool> declared(_nbRegisters,false);
+
+  s << "// generated by NoiseGraph\n";
+  s << "float computeHeight(in vec2 p) {\n";
+
+  for(unsigned int i=0;i<_program.size();++i) {
+    const Instruction &ins = _program[i];
+    const std::string d  = reg(ins.dst);
+    const std::string t  = declared[ins.dst] ? "  " : "  float ";
+    declared[ins.dst] = true;
+
+    switch(ins.op) {
+    case OP_POSITION:
+      s << "  float " << d << " = p.x;\n";
+      s << "  float " << reg(ins.dst+1) << " = p.y;\n";
+      declared[ins.dst+1] = true;
+      break;
+    case OP_FILL:
+      s << t << d << " = " << literal(ins.a) << ";\n";
+      break;
+    case OP_MOTION:
+      s << t << d << " = motion.x;\n";
+      break;
+    case OP_NOISE:
+    case OP_RIDGE: {
+      std::ostringstream n;
+      n << "gnoise(vec2(" << reg(ins.src[0]) << "," << reg(ins.src[0]+1) << ")*" << literal(ins.b);
+      if(ins.c!=0.0f || ins.d!=0.0f)
+        n << "+vec2(" << literal(ins.c) << "," << literal(ins.d) << ")";
+      n << ")";
+
+      if(ins.op==OP_NOISE)
+        s << "  " << d << " += " << literal(ins.a) << "*" << n.str() << ";\n";
+      else
+        s << "  { float r = 1.0-abs(" << n.str() << "); " << d << " += " << literal(ins.a) << "*r*r; }\n";
+      break;
+    }
+    case OP_WARP:
+      s << "  " << d << " = " << reg(ins.src[0]) << "+" << literal(ins.a) << "*" << d << ";\n";
+      s << "  " << reg(ins.dst+1) << " = " << reg(ins.src[0]+1) << "+" << literal(ins.a) << "*" << reg(ins.dst+1) << ";\n";
+      break;
+    case OP_SIN:
+      s << t << d << " = " << literal(ins.a) << "*sin(" << reg(ins.src[0]) << "*" << literal(ins.b) << ");\n";
+      break;
+    case OP_ADD:
+      s << t << d << " = " << reg(ins.src[0]) << "+" << reg(ins.src[1]) << ";\n";
+      break;
+    case OP_MUL:
+      s << t << d << " = " << reg(ins.src[0]) << "*" << reg(ins.src[1]) << ";\n";
+      break;
+    case OP_SCALE:
+      s << t << d << " = " << reg(ins.src[0]) << "*" << literal(ins.a) << "+" << literal(ins.b) << ";\n";
+      break;
+    }
+  }
+
+  s << "  return " << (_result>=0 ? reg(_result) : std::string("0.0")) << ";\n";
+  s << "}\n";
+
+  return s.str();
+}
+
+void NoiseGraph::evaluate(const float *x,const float *y,float motion,float *h,unsigned int n) const {
+  if(_result<0) {
+    std::fill(h,h+n,0.0f);
+    return;
+  }
+
+  // structure of arrays: each register holds BATCH lanes so that every
+  // instruction is a tight loop the compiler can vectorize
+  std::vector<float> regs(_nbRegisters*BATCH);
+
+  for(unsigned int start=0;start<n;start+=BATCH) {
+    const unsigned int count = std::min(BATCH,n-start);
+
+    for(unsigned int k=0;k<_program.size();++k) {
+      const Instruction &ins = _program[k];
+      float *d = &regs[ins.dst*BATCH];
+      const float *s0 = ins.src[0]>=0 ? &regs[ins.src[0]*BATCH] : NULL;
+      const float *s1 = ins.src[1]>=0 ? &regs[ins.src[1]*BATCH] : NULL;
+
+      switch(ins.op) {
+      case OP_POSITION:
+        std::copy(x+start,x+start+count,d);
+        std::copy(y+start,y+start+count,d+BATCH);
+        break;
+      case OP_FILL:
+        std::fill(d,d+count,ins.a);
+        break;
+      case OP_MOTION:
+        std::fill(d,d+count,motion);
+        break;
+      case OP_NOISE:
+        for(unsigned int i=0;i<count;++i)
+          d[i] += ins.a*gnoise(s0[i]*ins.b+ins.c,s0[i+BATCH]*ins.b+ins.d);
+        break;
+      case OP_RIDGE:
+        for(unsigned int i=0;i<count;++i) {
+          const float r = 1.0f-fabsf(gnoise(s0[i]*ins.b+ins.c,s0[i+BATCH]*ins.b+ins.d));
+          d[i] += ins.a*r*r;
+        }
+        break;
+      case OP_WARP:
+        for(unsigned int i=0;i<count;++i) {
+          d[i]       = s0[i]      +ins.a*d[i];
+          d[i+BATCH] = s0[i+BATCH]+ins.a*d[i+BATCH];
+        }
+        break;
+      case OP_SIN:
+        for(unsigned int i=0;i<count;++i)
+          d[i] = ins.a*sinf(s0[i]*ins.b);
+        break;
+      case OP_ADD:
+        for(unsigned int i=0;i<count;++i)
+          d[i] = s0[i]+s1[i];
+        break;
+      case OP_MUL:
+        for(unsigned int i=0;i<count;++i)
+          d[i] = s0[i]*s1[i];
+        break;
+      case OP_SCALE:
+        for(unsigned int i=0;i<count;++i)
+          d[i] = s0[i]*ins.a+ins.b;
+        break;
+      }
+    }
+
+    std::copy(&regs[_result*BATCH],&regs[_result*BATCH]+count,h+start);
+  }
+}
+
+NoiseGraph NoiseGraph::defaultTerrain() {
+  NoiseGraph g;
+
+  const int p = g.position();
+  const int n = g.fbm(p,0.5f,1.5f,0.5f,2);
+  const int m = g.add(n,g.motion());
+  g.setOutput(g.sin(m,0.1f,12.0f)); // [-0.1; 0.1]
+  g.compile();
+
+  return g;
+}
@@ -0,0 +1,84 @@
+#ifndef NOISEGRAPH_H
+#define NOISEGRAPH_H
+
+#include <string>
+#include <vector>
+
+// Declarative description of the terrain height function.
+// Nodes are created through the builder functions (each returns the node id)
+// and the graph is then compiled into a flat program: only the nodes reachable
+// from the output are kept and octave loops are unrolled with constant
+// amplitudes/frequencies. The same program is emitted as GLSL (computeHeight)
+// and evaluated on the CPU over batches of points.
+class NoiseGraph {
+ public:
+  enum NodeType {POSITION, MOTION, CONSTANT, FBM, RIDGED, WARP, SIN, ADD, MUL, SCALE};
+
+  NoiseGraph();
+
+  // inputs
+  int position();                 // vec2 sample position
+  int motion();                   // animation offset (motion.x)
+  int constant(float value);
+
+  // generators (domain is a vec2 node: position or warp)
+  int fbm(int domain,float amplitude,float frequency,float persistence,int nboctaves);
+  int ridged(int domain,float amplitude,float frequency,float persistence,int nboctaves);
+  int warp(int domain,float strength,float frequency,int nboctaves);
+
+  // scalar operators
+  int sin(int x,float amplitude,float frequency); // amplitude*sin(x*frequency)
+  int add(int a,int b);
+  int mul(int a,int b);
+  int scale(int x,float a,float b);               // x*a+b
+
+  void setOutput(int node);
+  void compile();
+
+  // GLSL definition of "float computeHeight(in vec2 p)"
+  // (needs gnoise() and the motion uniform to be declared before)
+  std::string glsl() const;
+
+  // CPU evaluation of n heights at positions (x[i],y[i])
+  void evaluate(const float *x,const float *y,float motion,float *h,unsigned int n) const;
+
+  // the terrain used so far: 0.1*sin((fbm(p,0.5,1.5,0.5,2)+motion.x)*12)
+  static NoiseGraph defaultTerrain();
+
+ private:
+  struct Node {
+    NodeType type;
+    int      inputs[2];
+    float    params[4];
+    int      octaves;
+  };
+
+  enum OpCode {OP_POSITION, OP_FILL, OP_MOTION, OP_NOISE, OP_RIDGE, OP_WARP,
+               OP_SIN, OP_ADD, OP_MUL, OP_SCALE};
+
+  // one unrolled operation: dst (op) src with constant parameters
+  struct Instruction {
+    OpCode op;
+    int    dst;
+    int    src[2];
+    float  a,b,c,d;
+  };
+
+  static const unsigned int BATCH = 64;
+
+  int addNode(NodeType type,int in0,int in1,float p0=0.0f,float p1=0.0f,float p2=0.0f,float p3=0.0f,int octaves=0);
+  bool isVector(NodeType type) const {return type==POSITION || type==WARP;}
+
+  void emitOctaves(OpCode op,int dst,int src,float amplitude,float frequency,
+                   float persistence,int nboctaves,float ox=0.0f,float oy=0.0f);
+
+  std::vector<Node>        _nodes;
+  int                      _output;
+
+  // compiled program
+  std::vector<Instruction> _program;
+  int                      _nbRegisters;
+  int                      _result;
+};
+
+#endif // NOISEGRAPH_H
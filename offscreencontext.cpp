@@ -0,0 +1,88 @@
+#include "offscreencontext.h"
+
+#include <EGL/eglext.h>
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+static bool hasExtension(const char *extensions,const char *name) {
+  return extensions && strstr(extensions,name)!=NULL;
+}
+
+OffscreenContext::OffscreenContext(int major,int minor) :
+  _display(EGL_NO_DISPLAY),
+  _context(EGL_NO_CONTEXT),
+  _surface(EGL_NO_SURFACE) {
+
+  // surfaceless platform first (client extension)
+  const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY,EGL_EXTENSIONS);
+  if(hasExtension(clientExtensions,"EGL_MESA_platform_surfaceless")) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if(getPlatformDisplay) {
+      _display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,NULL);
+    }
+  }
+  if(_display==EGL_NO_DISPLAY) {
+    _display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+
+  EGLint eglMajor,eglMinor;
+  if(_display==EGL_NO_DISPLAY || !eglInitialize(_display,&eglMajor,&eglMinor)) {
+    cerr << "Warning: no EGL display!" << endl;
+    return;
+  }
+
+  const bool surfaceless = hasExtension(eglQueryString(_display,EGL_EXTENSIONS),"EGL_KHR_surfaceless_context");
+
+  const EGLint configAttribs[] = {
+    EGL_SURFACE_TYPE,    surfaceless ? 0 : EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE,   8,
+    EGL_GREEN_SIZE, 8,
+    EGL_BLUE_SIZE,  8,
+    EGL_NONE
+  };
+
+  EGLConfig config;
+  EGLint nbConfigs = 0;
+  if(!eglChooseConfig(_display,configAttribs,&config,1,&nbConfigs) || nbConfigs==0) {
+    cerr << "Warning: no EGL config for desktop OpenGL!" << endl;
+    return;
+  }
+
+  eglBindAPI(EGL_OPENGL_API);
+
+  const EGLint contextAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION_KHR,       major,
+    EGL_CONTEXT_MINOR_VERSION_KHR,       minor,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+    EGL_NONE
+  };
+
+  _context = eglCreateContext(_display,config,EGL_NO_CONTEXT,contextAttribs);
+  if(_context==EGL_NO_CONTEXT) {
+    cerr << "Warning: cannot create an OpenGL " << major << "." << minor << " core context!" << endl;
+    return;
+  }
+
+  if(!surfaceless) {
+    const EGLint pbufferAttribs[] = {EGL_WIDTH,1,EGL_HEIGHT,1,EGL_NONE};
+    _surface = eglCreatePbufferSurface(_display,config,pbufferAttribs);
+  }
+}
+
+OffscreenContext::~OffscreenContext() {
+  if(_display==EGL_NO_DISPLAY)
+    return;
+
+  eglMakeCurrent(_display,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+  if(_surface!=EGL_NO_SURFACE) eglDestroySurface(_display,_surface);
+  if(_context!=EGL_NO_CONTEXT) eglDestroyContext(_display,_context);
+  eglTerminate(_display);
+}
+
+bool OffscreenContext::makeCurrent() {
+  return valid() && eglMakeCurrent(_display,_surface,_surface,_context)==EGL_TRUE;
+}
@@ -0,0 +1,26 @@
+#ifndef OFFSCREENCONTEXT_H
+#define OFFSCREENCONTEXT_H
+
+#include <EGL/egl.h>
+
+// OpenGL core context without any window, through EGL: the Mesa
+// surfaceless platform when available (no display server needed, works
+// with the software rasterizer), the default EGL display otherwise.
+// The context is made current without a surface when EGL allows it,
+// on a 1x1 pbuffer otherwise: the caller renders into its own fbo.
+class OffscreenContext {
+ public:
+  OffscreenContext(int major=3,int minor=3);
+  ~OffscreenContext();
+
+  inline bool valid() const {return _context!=EGL_NO_CONTEXT;}
+
+  bool makeCurrent();
+
+ private:
+  EGLDisplay _display;
+  EGLContext _context;
+  EGLSurface _surface; // EGL_NO_SURFACE when surfaceless
+};
+
+#endif // OFFSCREENCONTEXT_H
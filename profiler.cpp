@@ -0,0 +1,139 @@
+#include "profiler.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+std::atomic<bool> Profiler::_enabled(true);
+
+namespace {
+
+// (atomic fields: dump() may read a slot while its thread overwrites it)
+struct Slot {
+  std::atomic<const char *> name;
+  std::atomic<long long>    start; // ns since the origin
+  std::atomic<long long>    end;
+};
+
+struct Event {
+  const char *name;
+  long long   start;
+  long long   end;
+};
+
+// written by its thread only, read by dump(): the events before count are
+// complete, the slot of event count-RING_SIZE may be being overwritten
+struct Ring {
+  Slot                     *events; // RING_SIZE
+  std::atomic<unsigned int> count;
+  unsigned int              tid;
+  std::string               name;
+};
+
+const Profiler::Clock::time_point origin = Profiler::Clock::now();
+
+QMutex            ringsMutex;
+std::vector<Ring*> rings; // all the threads that recorded a zone (never freed)
+
+Ring *threadRing() {
+  static thread_local Ring *ring = NULL;
+
+  if(!ring) {
+    ring = new Ring();
+    ring->events = new Slot[Profiler::RING_SIZE];
+    ring->count = 0;
+
+    QMutexLocker locker(&ringsMutex);
+    ring->tid = (unsigned int)rings.size();
+    rings.push_back(ring);
+  }
+
+  return ring;
+}
+
+long long nanoseconds(Profiler::Clock::time_point t) {
+  return (long long)chrono::duration_cast<chrono::nanoseconds>(t-origin).count();
+}
+
+}
+
+void Profiler::setEnabled(bool enabled) {
+  _enabled.store(enabled,memory_order_relaxed);
+}
+
+void Profiler::setThreadName(const string &name) {
+  Ring *ring = threadRing();
+
+  QMutexLocker locker(&ringsMutex);
+  ring->name = name;
+}
+
+void Profiler::record(const char *name,Clock::time_point start,Clock::time_point end) {
+  Ring *ring = threadRing();
+
+  // the oldest zone is overwritten when the ring is full (a reader that sees
+  // any of these writes also sees count>=i, see dump())
+  const unsigned int i = ring->count.load(memory_order_relaxed);
+  Slot &e = ring->events[i%RING_SIZE];
+  atomic_thread_fence(memory_order_release);
+  e.name.store(name,memory_order_relaxed);
+  e.start.store(nanoseconds(start),memory_order_relaxed);
+  e.end.store(nanoseconds(end),memory_order_relaxed);
+  ring->count.store(i+1,memory_order_release);
+}
+
+bool Profiler::dump(const string &filename) {
+  ofstream file(filename.c_str());
+  if(!file.is_open()) {
+    cout << "Warning: cannot write " << filename << endl;
+    return false;
+  }
+
+  // complete events ("X"), times in microseconds
+  file << fixed;
+  file.precision(3);
+  file << "{\"traceEvents\":[" << endl;
+  bool first = true;
+
+  QMutexLocker locker(&ringsMutex);
+  for(unsigned int r=0;r<rings.size();++r) {
+    const Ring *ring = rings[r];
+
+    if(!ring->name.empty()) {
+      file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << ring->tid
+           << ",\"args\":{\"name\":\"" << ring->name << "\"}}";
+      first = false;
+    }
+
+    // copy the complete zones while the thread keeps recording, then drop the
+    // ones it may have overwritten meanwhile (seqlock: the count read after
+    // the copy covers every write the copy saw)
+    const unsigned int count = ring->count.load(memory_order_acquire);
+    const unsigned int begin = count>RING_SIZE ? count-RING_SIZE : 0;
+    vector<Event> zones(count-begin);
+    for(unsigned int i=begin;i<count;++i) {
+      const Slot &e = ring->events[i%RING_SIZE];
+      zones[i-begin].name  = e.name.load(memory_order_relaxed);
+      zones[i-begin].start = e.start.load(memory_order_relaxed);
+      zones[i-begin].end   = e.end.load(memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    const unsigned int countAfter = ring->count.load(memory_order_relaxed);
+    const unsigned int valid = countAfter>=RING_SIZE ? max(begin,countAfter-RING_SIZE+1) : begin;
+
+    for(unsigned int i=valid;i<count;++i) {
+      const Event &e = zones[i-begin];
+      file << (first ? "" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << ring->tid
+           << ",\"ts\":" << (double)e.start*1e-3 << ",\"dur\":" << (double)(e.end-e.start)*1e-3 << "}";
+      first = false;
+    }
+  }
+
+  file << "\n]}" << endl;
+  return true;
+}
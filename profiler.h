@@ -0,0 +1,57 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Scoped CPU zones: PROFILE_ZONE("name") measures the enclosing block.
+// Each thread stores its zones in its own ring buffer (the last RING_SIZE
+// ones are kept), so recording a zone is two clock reads and no lock.
+// The zones of all the threads can be written as a Chrome trace_event JSON
+// file (chrome://tracing, Perfetto). setEnabled(false) reduces a zone to a
+// flag test, and defining NO_PROFILER removes them at compile time.
+class Profiler {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  static const unsigned int RING_SIZE = 16384; // zones kept per thread
+
+  class Zone {
+   public:
+    inline Zone(const char *name) : _name(name),_active(enabled()) {
+      if(_active) _start = Clock::now();
+    }
+    inline ~Zone() {
+      if(_active) record(_name,_start,Clock::now());
+    }
+   private:
+    const char        *_name; // string literal
+    bool               _active;
+    Clock::time_point  _start;
+  };
+
+  static inline bool enabled() {return _enabled.load(std::memory_order_relaxed);}
+  static void setEnabled(bool enabled);
+
+  // name of the calling thread in the trace
+  static void setThreadName(const std::string &name);
+
+  // write the zones of all the threads (false if the file cannot be written)
+  static bool dump(const std::string &filename);
+
+ private:
+  static void record(const char *name,Clock::time_point start,Clock::time_point end);
+
+  static std::atomic<bool> _enabled;
+};
+
+#ifdef NO_PROFILER
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_CONCAT_(a,b) a##b
+#define PROFILE_CONCAT(a,b) PROFILE_CONCAT_(a,b)
+#define PROFILE_ZONE(name) Profiler::Zone PROFILE_CONCAT(profileZone,__LINE__)(name)
+#endif
+
+#endif // PROFILER_H
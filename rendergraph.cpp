@@ -0,0 +1,373 @@
+#include "rendergraph.h"
+#include "gputimer.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+// pool textures unused for more frames than this are deleted
+// (e.g. the ones of the previous window size after a resize)
+static const unsigned int POOL_LIFETIME = 3;
+
+// frames without a new window size before the storage is fitted again
+static const unsigned int RESIZE_SETTLE = 15;
+
+static bool isDepth(GLenum format) {
+  return format==GL_DEPTH_COMPONENT16 || format==GL_DEPTH_COMPONENT24 ||
+         format==GL_DEPTH_COMPONENT32 || format==GL_DEPTH_COMPONENT32F;
+}
+
+static int bucket(int size) {
+  const int b = RenderGraph::SIZE_BUCKET;
+  return std::max((size+b-1)/b,1)*b;
+}
+
+RenderGraph::RenderGraph() :
+  _width(0),
+  _height(0),
+  _frame(0),
+  _resized(0),
+  _culled(0),
+  _timer(NULL),
+  _backbuffer(0) {
+
+}
+
+RenderGraph::~RenderGraph() {
+  for(map<vector<GLuint>,GLuint>::iterator it=_fbos.begin();it!=_fbos.end();++it) {
+    glDeleteFramebuffers(1,&it->second);
+  }
+  for(unsigned int t=0;t<_pool.size();++t) {
+    glDeleteTextures(1,&_pool[t].id);
+  }
+}
+
+void RenderGraph::begin(int width,int height) {
+  _frame++;
+  if(width!=_width || height!=_height) {
+    _resized = _frame;
+  }
+  _width  = width;
+  _height = height;
+
+  _passes.clear();
+  _resources.clear();
+
+  // BACKBUFFER
+  ResourceNode backbuffer;
+  backbuffer.name     = "backbuffer";
+  backbuffer.imported = true;
+  backbuffer.desc     = TextureDesc(GL_RGBA8,width,height);
+  backbuffer.first    = backbuffer.last = -1;
+  backbuffer.physical = -1;
+  _resources.push_back(backbuffer);
+}
+
+RenderGraph::Resource RenderGraph::create(const string &name,const TextureDesc &desc) {
+  ResourceNode node;
+  node.name     = name;
+  node.imported = false;
+  node.desc     = desc;
+  node.first    = node.last = -1;
+  node.physical = -1;
+  _resources.push_back(node);
+  return (Resource)_resources.size()-1;
+}
+
+RenderGraph::Resource RenderGraph::import(const string &name) {
+  Resource r = create(name,TextureDesc());
+  _resources[r].imported = true;
+  return r;
+}
+
+void RenderGraph::addPass(const string &name,const vector<Resource> &reads,
+                          const vector<Resource> &writes,const Execute &execute) {
+  PassNode pass;
+  pass.name    = name;
+  pass.reads   = reads;
+  pass.writes  = writes;
+  pass.execute = execute;
+  pass.needed  = false;
+  _passes.push_back(pass);
+}
+
+void RenderGraph::compile() {
+  const int nbPasses = (int)_passes.size();
+
+  // roots: the passes writing persistent resources and the last write of the backbuffer
+  int present = -1;
+  for(int p=0;p<nbPasses;++p) {
+    for(unsigned int w=0;w<_passes[p].writes.size();++w) {
+      const Resource r = _passes[p].writes[w];
+      if(r==BACKBUFFER) {
+        present = p;
+      } else if(_resources[r].imported) {
+        _passes[p].needed = true;
+      }
+    }
+  }
+  if(present>=0) {
+    _passes[present].needed = true;
+  }
+
+  // backward: the last writer (before a needed pass) of each of its inputs is needed
+  for(int p=nbPasses-1;p>=0;--p) {
+    if(!_passes[p].needed) continue;
+
+    for(unsigned int i=0;i<_passes[p].reads.size();++i) {
+      const Resource r = _passes[p].reads[i];
+      for(int q=p-1;q>=0;--q) {
+        bool writes = false;
+        for(unsigned int w=0;w<_passes[q].writes.size();++w) {
+          writes = writes || _passes[q].writes[w]==r;
+        }
+        if(writes) {
+          _passes[q].needed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  // lifetimes of the transient textures, over the remaining passes
+  _culled = 0;
+  for(int p=0;p<nbPasses;++p) {
+    if(!_passes[p].needed) {
+      _culled++;
+      continue;
+    }
+
+    for(int k=0;k<2;++k) {
+      const vector<Resource> &used = k==0 ? _passes[p].writes : _passes[p].reads;
+      for(unsigned int u=0;u<used.size();++u) {
+        ResourceNode &node = _resources[used[u]];
+        if(node.imported) continue;
+        if(node.first<0) node.first = p;
+        node.last = p;
+      }
+    }
+  }
+
+  // assign the textures: a texture released by a resource can be acquired
+  // by a resource first used later in the frame (aliasing)
+  for(unsigned int t=0;t<_pool.size();++t) {
+    _pool[t].busy = false;
+  }
+
+  for(int p=0;p<nbPasses;++p) {
+    if(!_passes[p].needed) continue;
+
+    for(unsigned int r=0;r<_resources.size();++r) {
+      if(!_resources[r].imported && _resources[r].first==p) {
+        _resources[r].physical = acquire(_resources[r].desc);
+      }
+    }
+
+    for(unsigned int r=0;r<_resources.size();++r) {
+      if(!_resources[r].imported && _resources[r].last==p) {
+        _pool[_resources[r].physical].busy = false;
+      }
+    }
+  }
+
+  collect();
+}
+
+void RenderGraph::execute() {
+  for(unsigned int p=0;p<_passes.size();++p) {
+    if(!_passes[p].needed) continue;
+
+    if(_timer) _timer->begin(_passes[p].name);
+    bindTargets(_passes[p]);
+    _passes[p].execute();
+    if(_timer) _timer->end();
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER,_backbuffer);
+  glViewport(0,0,_width,_height);
+}
+
+GLuint RenderGraph::texture(Resource r) const {
+  const ResourceNode &node = _resources[r];
+  return (node.imported || node.physical<0) ? 0 : _pool[node.physical].id;
+}
+
+void RenderGraph::textureSize(Resource r,int &width,int &height) const {
+  const ResourceNode &node = _resources[r];
+  const bool assigned = !node.imported && node.physical>=0;
+  width  = assigned ? _pool[node.physical].desc.width  : node.desc.width;
+  height = assigned ? _pool[node.physical].desc.height : node.desc.height;
+}
+
+void RenderGraph::dump() const {
+  for(unsigned int p=0;p<_passes.size();++p) {
+    const PassNode &pass = _passes[p];
+    cout << (pass.needed ? " " : "[") << pass.name << (pass.needed ? " " : "]") << " ->";
+    for(unsigned int w=0;w<pass.writes.size();++w) {
+      const ResourceNode &node = _resources[pass.writes[w]];
+      cout << " " << node.name;
+      if(!node.imported && node.physical>=0) {
+        const TextureDesc &storage = _pool[node.physical].desc;
+        cout << "(tex " << _pool[node.physical].id << ", " << node.desc.width << "x" << node.desc.height
+             << " in " << storage.width << "x" << storage.height << ")";
+      }
+    }
+    cout << endl;
+  }
+}
+
+int RenderGraph::acquire(const TextureDesc &desc) {
+  // a resource within the window (a scaled render target) gets the storage
+  // of the window bucket: every internal resolution then shares it
+  const bool inWindow = desc.width<=_width && desc.height<=_height;
+  const TextureDesc fitted(desc.format,
+                           bucket(inWindow ? _width  : desc.width),
+                           bucket(inWindow ? _height : desc.height));
+  const bool settled = _frame-_resized>=RESIZE_SETTLE;
+
+  // smallest free texture the resource fits in (none larger than its fitted
+  // size or the window bucket once the window size settled: only the ones
+  // of a previous larger window are then released)
+  const int maxWidth  = max(fitted.width,bucket(_width));
+  const int maxHeight = max(fitted.height,bucket(_height));
+  int best = -1;
+  for(unsigned int t=0;t<_pool.size();++t) {
+    const TextureDesc &s = _pool[t].desc;
+    if(_pool[t].busy || s.format!=desc.format || s.width<desc.width || s.height<desc.height) continue;
+    if(settled && (s.width>maxWidth || s.height>maxHeight)) continue;
+    if(best<0 || s.width*s.height<_pool[best].desc.width*_pool[best].desc.height) {
+      best = (int)t;
+    }
+  }
+  if(best>=0) {
+    _pool[best].busy = true;
+    _pool[best].lastFrame = _frame;
+    return best;
+  }
+
+  // no free texture large enough
+  Texture tex;
+  tex.desc      = fitted;
+  tex.lastFrame = _frame;
+  tex.busy      = true;
+
+  // immutable storage when available (no respecification, complete at once)
+  const bool depth = isDepth(desc.format);
+  glGenTextures(1,&tex.id);
+  glBindTexture(GL_TEXTURE_2D,tex.id);
+  if(GLEW_ARB_texture_storage || GLEW_VERSION_4_2) {
+    glTexStorage2D(GL_TEXTURE_2D,1,fitted.format,fitted.width,fitted.height);
+  } else {
+    glTexImage2D(GL_TEXTURE_2D,0,fitted.format,fitted.width,fitted.height,0,
+                 depth ? GL_DEPTH_COMPONENT : GL_RGBA,GL_FLOAT,NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D,0);
+
+  _pool.push_back(tex);
+  return (int)_pool.size()-1;
+}
+
+void RenderGraph::collect() {
+  // delete the textures (and the fbos using them) unused for a few frames
+  for(unsigned int t=0;t<_pool.size();) {
+    if(_frame-_pool[t].lastFrame<=POOL_LIFETIME) {
+      ++t;
+      continue;
+    }
+
+    const GLuint id = _pool[t].id;
+    for(map<vector<GLuint>,GLuint>::iterator it=_fbos.begin();it!=_fbos.end();) {
+      bool uses = false;
+      for(unsigned int a=0;a<it->first.size();++a) {
+        uses = uses || it->first[a]==id;
+      }
+      if(uses) {
+        glDeleteFramebuffers(1,&it->second);
+        _fbos.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+    glDeleteTextures(1,&_pool[t].id);
+
+    // the resources of this frame point to the following textures
+    _pool.erase(_pool.begin()+t);
+    for(unsigned int r=0;r<_resources.size();++r) {
+      if(_resources[r].physical>(int)t) _resources[r].physical--;
+    }
+  }
+}
+
+GLuint RenderGraph::framebuffer(const vector<GLuint> &colors,GLuint depth) {
+  vector<GLuint> key(colors);
+  key.push_back(depth);
+
+  map<vector<GLuint>,GLuint>::iterator it = _fbos.find(key);
+  if(it!=_fbos.end()) {
+    return it->second;
+  }
+
+  GLuint fbo;
+  glGenFramebuffers(1,&fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER,fbo);
+
+  vector<GLenum> buffers;
+  for(unsigned int c=0;c<colors.size();++c) {
+    glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0+c,GL_TEXTURE_2D,colors[c],0);
+    buffers.push_back(GL_COLOR_ATTACHMENT0+c);
+  }
+  if(depth) {
+    glFramebufferTexture2D(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_TEXTURE_2D,depth,0);
+  }
+
+  // the draw buffers are part of the fbo state
+  if(buffers.empty()) {
+    glDrawBuffer(GL_NONE);
+  } else {
+    glDrawBuffers((GLsizei)buffers.size(),&buffers[0]);
+  }
+
+  if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    cout << "Warning: render graph FBO not complete!" << endl;
+  }
+
+  _fbos[key] = fbo;
+  return fbo;
+}
+
+void RenderGraph::bindTargets(const PassNode &pass) {
+  vector<GLuint> colors;
+  GLuint depth = 0;
+  const TextureDesc *size = NULL;
+
+  for(unsigned int w=0;w<pass.writes.size();++w) {
+    const Resource r = pass.writes[w];
+    if(r==BACKBUFFER) {
+      glBindFramebuffer(GL_FRAMEBUFFER,_backbuffer);
+      glViewport(0,0,_width,_height);
+      return;
+    }
+
+    const ResourceNode &node = _resources[r];
+    if(node.imported) continue;
+
+    if(isDepth(node.desc.format)) {
+      depth = texture(r);
+    } else {
+      colors.push_back(texture(r));
+    }
+    size = &node.desc;
+  }
+
+  // only persistent resources: the pass binds its own targets
+  if(!size) return;
+
+  glBindFramebuffer(GL_FRAMEBUFFER,framebuffer(colors,depth));
+  glViewport(0,0,size->width,size->height);
+}
@@ -0,0 +1,135 @@
+#ifndef RENDERGRAPH_H
+#define RENDERGRAPH_H
+
+// GLEW lib: needs to be included first!!
+#include <GL/glew.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+class GpuTimer;
+
+// Declarative description of the passes of a frame. Each frame, the passes
+// are added in execution order with the resources they read and write, then
+// compile() culls the passes whose outputs are never used and allocates the
+// transient textures from a pool: two transient textures with the same
+// description and non-overlapping lifetimes share the same texture.
+// Imported resources (tile maps, shadow maps...) are owned by the viewer and
+// persist between frames: a pass writing one of them is never culled. The
+// frame result is the last write of the backbuffer.
+// The pool textures have an immutable storage rounded up to SIZE_BUCKET
+// pixels: a texture is reused by any smaller resource, which then only
+// covers its bottom left corner (the pass viewport is the resource size).
+// Resources no larger than the window are allocated at the window bucket,
+// so a scaled render target keeps its texture whatever the scale.
+// While the window is being resized, the storage of the larger size is
+// kept; once the size settles, textures larger than the window bucket (or
+// than the resource bucket) are replaced.
+class RenderGraph {
+ public:
+  typedef int Resource;
+  typedef std::function<void()> Execute;
+
+  // the final framebuffer (the default one unless setBackbuffer is used)
+  static const Resource BACKBUFFER = 0;
+
+  // storage sizes are multiples of this
+  static const int SIZE_BUCKET = 128;
+
+  struct TextureDesc {
+    GLenum format;  // internal format (depth formats are depth attachments)
+    int    width;
+    int    height;
+
+    TextureDesc(GLenum f=GL_RGBA8,int w=0,int h=0) : format(f),width(w),height(h) {}
+    inline bool operator==(const TextureDesc &d) const {
+      return format==d.format && width==d.width && height==d.height;
+    }
+  };
+
+  RenderGraph();
+  ~RenderGraph();
+
+  // start the declaration of a frame (window size: viewport of the backbuffer)
+  void begin(int width,int height);
+
+  // declare a texture living during the frame only / a persistent resource
+  Resource create(const std::string &name,const TextureDesc &desc);
+  Resource import(const std::string &name);
+
+  // add a pass, executed in declaration order. The written transient
+  // textures (and the backbuffer) are bound as render targets before
+  // execute is called, in the order of writes for the color attachments
+  void addPass(const std::string &name,const std::vector<Resource> &reads,
+               const std::vector<Resource> &writes,const Execute &execute);
+
+  // cull the unused passes and assign the transient textures
+  void compile();
+
+  // run the remaining passes
+  void execute();
+
+  // texture assigned to a transient resource (valid after compile)
+  GLuint texture(Resource r) const;
+
+  // storage size of that texture (at least the resource size)
+  void textureSize(Resource r,int &width,int &height) const;
+
+  // passes culled by the last compile
+  inline unsigned int culledPasses() const {return _culled;}
+
+  // print the passes of the last compile (culled ones in brackets)
+  void dump() const;
+
+  // time the executed passes (NULL: no timing)
+  inline void setTimer(GpuTimer *timer) {_timer = timer;}
+
+  // fbo standing for BACKBUFFER (offscreen rendering)
+  inline void setBackbuffer(GLuint fbo) {_backbuffer = fbo;}
+  inline GLuint backbuffer() const {return _backbuffer;}
+
+ private:
+  struct ResourceNode {
+    std::string name;
+    bool        imported;
+    TextureDesc desc;
+    int         first,last; // lifetime (pass indices, -1: unused)
+    int         physical;   // index in the pool
+  };
+
+  struct PassNode {
+    std::string           name;
+    std::vector<Resource> reads;
+    std::vector<Resource> writes;
+    Execute               execute;
+    bool                  needed;
+  };
+
+  struct Texture {
+    TextureDesc  desc;      // storage (bucketed size)
+    GLuint       id;
+    unsigned int lastFrame; // last frame using it (released after a few frames)
+    bool         busy;      // assigned to a live resource during compile
+  };
+
+  int    acquire(const TextureDesc &desc);
+  void   collect();
+  GLuint framebuffer(const std::vector<GLuint> &colors,GLuint depth);
+  void   bindTargets(const PassNode &pass);
+
+  std::vector<ResourceNode> _resources;
+  std::vector<PassNode>     _passes;
+  std::vector<Texture>      _pool;
+  std::map<std::vector<GLuint>,GLuint> _fbos; // attachments (depth last) -> fbo
+
+  int          _width,_height;
+  unsigned int _frame;
+  unsigned int _resized;  // last frame with a new window size
+  unsigned int _culled;
+  GpuTimer    *_timer;
+  GLuint       _backbuffer;
+};
+
+#endif // RENDERGRAPH_H
@@ -0,0 +1,76 @@
+#include "renderthread.h"
+#include "viewer.h"
+
+#include <QCoreApplication>
+#include <QMetaObject>
+#include <QMutexLocker>
+
+RenderThread::RenderThread(Viewer *viewer) :
+  _viewer(viewer),
+  _running(true),
+  _requested(false),
+  _resized(false),
+  _width(0),
+  _height(0) {
+
+}
+
+void RenderThread::resize(int width,int height) {
+  QMutexLocker locker(&_mutex);
+  _width   = width;
+  _height  = height;
+  _resized = true;
+  _wake.wakeOne();
+}
+
+void RenderThread::requestFrame() {
+  QMutexLocker locker(&_mutex);
+  _requested = true;
+  _wake.wakeOne();
+}
+
+void RenderThread::stop() {
+  {
+    QMutexLocker locker(&_mutex);
+    _running = false;
+    _wake.wakeOne();
+  }
+  wait();
+}
+
+void RenderThread::run() {
+  Profiler::setThreadName("render");
+
+  // (the GUI thread moved the context to this thread)
+  _viewer->makeCurrent();
+  _viewer->initializeGL();
+
+  QMutexLocker locker(&_mutex);
+  while(_running) {
+    if(!_requested && !_resized) {
+      _wake.wait(&_mutex);
+    }
+    if(!_running) break;
+
+    const bool resized = _resized;
+    const int width = _width, height = _height;
+    _requested = _resized = false;
+    locker.unlock();
+
+    // a resize also redraws the window
+    if(resized) {
+      _viewer->resizeGL(width,height);
+    }
+    _viewer->paintGL();
+    _viewer->swapBuffers();
+
+    // the scheduler starts the next frame once this one is swapped
+    QMetaObject::invokeMethod(_viewer->scheduler(),"frameDone",Qt::QueuedConnection);
+    locker.relock();
+  }
+  locker.unlock();
+
+  // the GL objects are deleted by the GUI thread
+  _viewer->doneCurrent();
+  _viewer->context()->moveToThread(QCoreApplication::instance()->thread());
+}
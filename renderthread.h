@@ -0,0 +1,43 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+class Viewer;
+
+// Thread owning the GL context of the viewer once rendering starts: the
+// GL initialization, resizes, frames and buffer swaps all happen here,
+// the GUI thread only queues the input and frame requests. Each frame
+// ends with a queued frameDone() to the frame scheduler.
+class RenderThread : public QThread {
+  Q_OBJECT
+
+ public:
+  RenderThread(Viewer *viewer);
+
+  // new window size (GUI thread), applied before the next frame
+  void resize(int width,int height);
+
+  // finish the current frame and give the context back to the GUI thread
+  void stop();
+
+ public slots:
+  // draw a frame as soon as possible (any thread)
+  void requestFrame();
+
+ protected:
+  virtual void run();
+
+ private:
+  Viewer        *_viewer;
+  QMutex         _mutex;
+  QWaitCondition _wake;
+  bool           _running;
+  bool           _requested;
+  bool           _resized;
+  int            _width,_height;
+};
+
+#endif // RENDERTHREAD_H
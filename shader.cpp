@@ -1,4 +1,5 @@
 #include "shader.h"
+#include "profiler.h"
 
 #include <stdio.h>
 #include <vector>
@@ -23,6 +24,7 @@ Shader::~Shader() {
 
 void Shader::load(const char *vertex_file_path,
 		  const char *fragment_file_path) {
+  PROFILE_ZONE("Shader::load");
   
   // create and compile vertex shader object
   std::string vertexCode   = getCode(vertex_file_path);
@@ -48,6 +50,7 @@ void Shader::load(const char *vertex_file_path,
   glAttachShader(_programId,fragmentId);
   glLinkProgram(_programId);
   checkLinks(_programId);
+  reflect();
 
   // delete vertex and fragment ids
   glDeleteShader(vertexId);
@@ -71,6 +74,118 @@ void Shader::reload(const char *vertex_file_path,
 
 
 
+void Shader::setInclude(const std::string &name,const std::string &code) {
+  _includes[name] = code;
+}
+
+void Shader::setBlockBinding(const std::string &name,GLuint binding) {
+  _blockBindings[name] = binding;
+
+  if(glIsProgram(_programId)) {
+    const GLuint index = glGetUniformBlockIndex(_programId,name.c_str());
+    if(index!=GL_INVALID_INDEX)
+      glUniformBlockBinding(_programId,index,binding);
+  }
+}
+
+void Shader::reflect() {
+  _uniforms.clear();
+
+  for(std::map<std::string,GLuint>::const_iterator it=_blockBindings.begin();it!=_blockBindings.end();++it) {
+    const GLuint index = glGetUniformBlockIndex(_programId,it->first.c_str());
+    if(index!=GL_INVALID_INDEX)
+      glUniformBlockBinding(_programId,index,it->second);
+  }
+
+  GLint nbUniforms = 0, maxLength = 0;
+  glGetProgramiv(_programId,GL_ACTIVE_UNIFORMS,&nbUniforms);
+  glGetProgramiv(_programId,GL_ACTIVE_UNIFORM_MAX_LENGTH,&maxLength);
+
+  std::vector<char> name(maxLength+1);
+  for(GLint k=0;k<nbUniforms;++k) {
+    Uniform u;
+    glGetActiveUniform(_programId,k,maxLength+1,NULL,&u.size,&u.type,&name[0]);
+    u.location = glGetUniformLocation(_programId,&name[0]);
+
+    // uniform block members have no location
+    if(u.location<0) continue;
+
+    // arrays are reported as "name[0]"
+    char *bracket = strchr(&name[0],'[');
+    if(bracket) *bracket = '\0';
+
+    // two names of the same hash: the second one would silently take the place of the first
+    u.name = &name[0];
+    const Hash h = hash(&name[0]);
+    std::map<Hash,Uniform>::const_iterator it = _uniforms.find(h);
+    if(it!=_uniforms.end()) {
+      cerr << "Warning: uniforms " << it->second.name << " and " << u.name << " have the same hash, "
+           << u.name << " is ignored" << endl;
+      continue;
+    }
+
+    _uniforms[h] = u;
+  }
+}
+
+GLint Shader::location(Hash name) const {
+  std::map<Hash,Uniform>::const_iterator it = _uniforms.find(name);
+  return it!=_uniforms.end() ? it->second.location : -1;
+}
+
+Shader::Uniform *Shader::changed(Hash name,const void *data,unsigned int bytes) {
+  std::map<Hash,Uniform>::iterator it = _uniforms.find(name);
+  if(it==_uniforms.end())
+    return NULL;
+
+  Uniform &u = it->second;
+  if(u.value.size()==bytes && memcmp(&u.value[0],data,bytes)==0)
+    return NULL;
+
+  u.value.assign((const unsigned char *)data,(const unsigned char *)data+bytes);
+  return &u;
+}
+
+void Shader::setUniform(Hash name,int value) {
+  Uniform *u = changed(name,&value,sizeof(value));
+  if(u) glUniform1i(u->location,value);
+}
+
+void Shader::setUniform(Hash name,float value) {
+  Uniform *u = changed(name,&value,sizeof(value));
+  if(u) glUniform1f(u->location,value);
+}
+
+void Shader::setUniform(Hash name,const glm::vec2 &value) {
+  Uniform *u = changed(name,&value[0],sizeof(value));
+  if(u) glUniform2fv(u->location,1,&value[0]);
+}
+
+void Shader::setUniform(Hash name,const glm::vec3 &value) {
+  Uniform *u = changed(name,&value[0],sizeof(value));
+  if(u) glUniform3fv(u->location,1,&value[0]);
+}
+
+void Shader::setUniform(Hash name,const glm::vec4 &value) {
+  Uniform *u = changed(name,&value[0],sizeof(value));
+  if(u) glUniform4fv(u->location,1,&value[0]);
+}
+
+void Shader::setUniform(Hash name,const glm::mat3 &value) {
+  Uniform *u = changed(name,&value[0][0],sizeof(value));
+  if(u) glUniformMatrix3fv(u->location,1,GL_FALSE,&value[0][0]);
+}
+
+void Shader::setUniform(Hash name,const glm::mat4 &value) {
+  Uniform *u = changed(name,&value[0][0],sizeof(value));
+  if(u) glUniformMatrix4fv(u->location,1,GL_FALSE,&value[0][0]);
+}
+
+void Shader::setUniform(Hash name,const glm::mat4 *values,int count) {
+  Uniform *u = changed(name,&values[0][0][0],count*sizeof(glm::mat4));
+  if(u) glUniformMatrix4fv(u->location,count,GL_FALSE,&values[0][0][0]);
+}
+
 void Shader::checkCompilation(GLuint shaderId) {
   // check if the compilation was successfull (and display syntax errors)
   // call it after each shader compilation
@@ -114,8 +229,19 @@ std::string Shader::getCode(const char *file_path) {
   }
 
   std::string line = "";
-  while(getline(shaderStream,line))
+  while(getline(shaderStream,line)) {
+    // replace the registered includes by their code
+    if(line.compare(0,10,"#include \"")==0) {
+      const std::string name = line.substr(10,line.find('"',10)-10);
+      std::map<std::string,std::string>::const_iterator it = _includes.find(name);
+      if(it!=_includes.end()) {
+        shaderCode += "\n" + it->second;
+        continue;
+      }
+      cout << "Unknown include " << name << " in " << file_path << endl;
+    }
     shaderCode += "\n" + line;
+  }
   shaderStream.close();
   
   return shaderCode;
@@ -3,9 +3,21 @@
 
 #include <GL/glew.h>
 #include <string>
+#include <map>
+#include <vector>
+
+// OpenGL Mathematics
+#include <glm/glm.hpp>
 
 class Shader {
  public:
+  // uniform names are looked up by their FNV-1a hash (computed at compile
+  // time for literals: setUniform(Shader::hash("name"),value))
+  typedef unsigned int Hash;
+  static constexpr Hash hash(const char *name,Hash h=2166136261u) {
+    return *name ? hash(name+1,(h^(unsigned char)*name)*16777619u) : h;
+  }
+
   Shader();
   ~Shader();
 
@@ -17,8 +29,47 @@ class Shader {
 
   inline GLuint id() {return _programId;}
 
+  // location of an active uniform (-1 if the program does not use it)
+  GLint location(Hash name) const;
+
+  // typed setters of the program uniforms (the program has to be in use):
+  // unknown uniforms are ignored and unchanged values are not uploaded again
+  void setUniform(Hash name,int value);
+  void setUniform(Hash name,float value);
+  void setUniform(Hash name,const glm::vec2 &value);
+  void setUniform(Hash name,const glm::vec3 &value);
+  void setUniform(Hash name,const glm::vec4 &value);
+  void setUniform(Hash name,const glm::mat3 &value);
+  void setUniform(Hash name,const glm::mat4 &value);
+  void setUniform(Hash name,const glm::mat4 *values,int count);
+
+  // code substituted to the line '#include "name"' of the loaded sources
+  void setInclude(const std::string &name,const std::string &code);
+
+  // binding point of a uniform block (kept when the program is reloaded)
+  void setBlockBinding(const std::string &name,GLuint binding);
+
  private:
+  // active uniform of the linked program and its last uploaded value
+  struct Uniform {
+    std::string name; // (hash collisions are reported by reflect)
+    GLint  location;
+    GLenum type;
+    GLint  size;
+    std::vector<unsigned char> value; // empty until the first upload
+  };
+
   GLuint _programId;
+  std::map<std::string,std::string> _includes;
+  std::map<Hash,Uniform> _uniforms;
+  std::map<std::string,GLuint> _blockBindings;
+
+  // list the active uniforms after linking (forgets the uploaded values)
+  // and bind the uniform blocks
+  void reflect();
+
+  // the uniform exists and its value differs from the last upload (which is updated)
+  Uniform *changed(Hash name,const void *data,unsigned int bytes);
 
   // string containing the source code of the input file
   std::string getCode(const char *file_path);
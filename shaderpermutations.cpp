@@ -0,0 +1,59 @@
+#include "shaderpermutations.h"
+#include "profiler.h"
+
+using namespace std;
+
+ShaderPermutations::ShaderPermutations(const string &vertexFile,const string &fragmentFile,
+                                       const string &include,Defines defines) :
+  _vertexFile(vertexFile),
+  _fragmentFile(fragmentFile),
+  _include(include),
+  _defines(defines) {
+
+}
+
+ShaderPermutations::~ShaderPermutations() {
+  for(map<unsigned int,Shader*>::iterator it=_programs.begin();it!=_programs.end();++it) {
+    delete it->second;
+  }
+}
+
+Shader *ShaderPermutations::get(unsigned int key) {
+  map<unsigned int,Shader*>::iterator it = _programs.find(key);
+  if(it!=_programs.end()) {
+    return it->second;
+  }
+
+  PROFILE_ZONE("ShaderPermutations::compile");
+
+  Shader *shader = new Shader();
+  shader->setInclude(_include,_defines(key));
+  for(map<string,GLuint>::const_iterator b=_blockBindings.begin();b!=_blockBindings.end();++b) {
+    shader->setBlockBinding(b->first,b->second);
+  }
+  shader->load(_vertexFile.c_str(),_fragmentFile.c_str());
+
+  _programs[key] = shader;
+  return shader;
+}
+
+void ShaderPermutations::precompile(const vector<unsigned int> &keys) {
+  for(unsigned int k=0;k<keys.size();++k) {
+    get(keys[k]);
+  }
+}
+
+void ShaderPermutations::reload() {
+  for(map<unsigned int,Shader*>::iterator it=_programs.begin();it!=_programs.end();++it) {
+    it->second->reload(_vertexFile.c_str(),_fragmentFile.c_str());
+  }
+}
+
+void ShaderPermutations::setBlockBinding(const string &name,GLuint binding) {
+  _blockBindings[name] = binding;
+
+  // (applied when the cached programs are reloaded)
+  for(map<unsigned int,Shader*>::iterator it=_programs.begin();it!=_programs.end();++it) {
+    it->second->setBlockBinding(name,binding);
+  }
+}
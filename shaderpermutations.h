@@ -0,0 +1,49 @@
+#ifndef SHADERPERMUTATIONS_H
+#define SHADERPERMUTATIONS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "shader.h"
+
+// Programs specialized from the same sources for each permutation key
+// (e.g. a mask of enabled effects): the defines of a key are substituted
+// to the '#include "name"' line, so each program only contains the code of
+// its features (no runtime branch). Programs are compiled on first use,
+// or ahead with precompile(), and cached by key: switching between
+// permutations already seen compiles nothing.
+class ShaderPermutations {
+ public:
+  // code of the include for a key
+  typedef std::string (*Defines)(unsigned int key);
+
+  ShaderPermutations(const std::string &vertexFile,const std::string &fragmentFile,
+                     const std::string &include,Defines defines);
+  ~ShaderPermutations();
+
+  // program of a permutation (compiled if not cached yet)
+  Shader *get(unsigned int key);
+
+  // compile the given permutations now (e.g. at startup)
+  void precompile(const std::vector<unsigned int> &keys);
+
+  // recompile the cached permutations (the sources changed)
+  void reload();
+
+  // binding point of a uniform block in every permutation
+  void setBlockBinding(const std::string &name,GLuint binding);
+
+  inline unsigned int nbPrograms() const {return (unsigned int)_programs.size();}
+
+ private:
+  std::string _vertexFile;
+  std::string _fragmentFile;
+  std::string _include;
+  Defines     _defines;
+
+  std::map<std::string,GLuint>   _blockBindings;
+  std::map<unsigned int,Shader*> _programs;
+};
+
+#endif // SHADERPERMUTATIONS_H
@@ -0,0 +1,31 @@
+#version 330
+
+// input uniforms
+uniform sampler2DArray heightmap; // tile heights (level 0 source)
+uniform sampler2DArray minmax;    // min/max chain: its level 0 is the source level
+uniform int layer;
+uniform int level;                // level being written
+
+out vec2 outMinMax;
+
+void main() {
+	// each texel bounds the 2x2 texels of the previous level
+	ivec2 p = ivec2(gl_FragCoord.xy) * 2;
+	vec2 a, b, c, d;
+	
+	if (level == 0) {
+		a = texelFetch(heightmap, ivec3(p, layer), 0).xx;
+		b = texelFetch(heightmap, ivec3(p + ivec2(1, 0), layer), 0).xx;
+		c = texelFetch(heightmap, ivec3(p + ivec2(0, 1), layer), 0).xx;
+		d = texelFetch(heightmap, ivec3(p + ivec2(1, 1), layer), 0).xx;
+	} else {
+		// (level - 1, the base level of the texture while this level is written)
+		a = texelFetch(minmax, ivec3(p, layer), 0).xy;
+		b = texelFetch(minmax, ivec3(p + ivec2(1, 0), layer), 0).xy;
+		c = texelFetch(minmax, ivec3(p + ivec2(0, 1), layer), 0).xy;
+		d = texelFetch(minmax, ivec3(p + ivec2(1, 1), layer), 0).xy;
+	}
+	
+	outMinMax = vec2(min(min(a.x, b.x), min(c.x, d.x)),
+	                 max(max(a.y, b.y), max(c.y, d.y)));
+}
@@ -0,0 +1,8 @@
+#version 330
+
+// input attributes 
+layout(location = 0) in vec3 position; 
+
+void main() {
+  gl_Position = vec4(position,1.0);
+}
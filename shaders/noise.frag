@@ -2,7 +2,17 @@
 
 in vec2 texcoord;
 
-uniform vec3 motion;
+// per-frame constants (shared by all passes)
+layout(std140) uniform Frame {
+  mat4 mdvMat;      // modelview matrix
+  mat4 projMat;     // projection matrix
+  mat4 normalMat;   // normal matrix (3x3 part)
+  vec4 light;       // light direction (view space)
+  vec4 lightWorld;  // light direction (world space)
+  vec4 motion;      // motion offset of the noise
+};
+uniform vec2 tileOrigin; // tile coordinates (1 tile = 1 unit of noise)
+uniform float tileResol; // tile size in texels
 
 // out buffers
 layout(location = 0) out vec4 outBufferNormal;
@@ -27,24 +37,8 @@ float gnoise(in vec2 p) {
 		 dot(hash(i+vec2(1.0,1.0)),f-vec2(1.0,1.0)),u.x),u.y);
 }
 
-float pnoise(in vec2 p,in float amplitude,in float frequency,in float persistence, in int nboctaves) {
-  float a = amplitude;
-  float f = frequency;
-  float n = 0.0;
-  
-  for(int i=0;i<nboctaves;++i) {
-    n = n+a*gnoise(p*f);
-    f = f*2.;
-    a = a*persistence;
-  }
-  
-  return n;
-}
-
-float computeHeight(in vec2 p) {
-  // sinus animé
-  return 0.1 * sin((pnoise(p, 0.5, 1.5, 0.5, 2)+motion.x)*12); // [-0.1; 0.1]
-}
+// computeHeight, generated from the terrain NoiseGraph
+#include "height"
 
 vec3 computeNormal(in vec2 p) {
   const float EPS = 0.01;
@@ -61,8 +55,11 @@ vec3 computeNormal(in vec2 p) {
 }
 
 void main() {
-	float h = computeHeight(texcoord.xy);
-	vec3 n = computeNormal(texcoord.xy);
+	// texel centers span the whole tile so that borders match the neighbours
+	vec2 p = tileOrigin + (gl_FragCoord.xy - 0.5) / (tileResol - 1.0);
+	
+	float h = computeHeight(p);
+	vec3 n = computeNormal(p);
 	
 	outBufferNormal = vec4(n, h);
 	outBufferHeight = vec4(h);
@@ -1,17 +1,88 @@
 #version 330
 
-#define FOG_EFFECT 0
-#define PIXEL_EFFECT 0
+// FOG_EFFECT, PIXEL_EFFECT, UPSCALE, TEMPORAL (set by the viewer)
+#include "effects"
 
 // in variables
 in vec2 texcoord;
 
+// per-frame constants (shared by all passes)
+layout(std140) uniform Frame {
+  mat4 mdvMat;      // modelview matrix
+  mat4 projMat;     // projection matrix
+  mat4 normalMat;   // normal matrix (3x3 part)
+  vec4 light;       // light direction (view space)
+  vec4 lightWorld;  // light direction (world space)
+  vec4 motion;      // motion offset of the noise
+};
+
 // input uniforms
-uniform sampler2D colormap;
-uniform sampler2D normalmap;
+uniform sampler2D colormap;   // window size with TEMPORAL (accumulated frames)
+uniform sampler2D normalmap;  // octahedral (RG16)
+uniform sampler2D depthmap;
+uniform vec2 gbufferSize;     // frame size in the textures (their storage can be larger)
 
 out vec4 outBuffer;
 
+// [0,1] square to unit vector (inverse of the terrain encoding)
+vec3 decodeNormal(in vec2 e) {
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+// view space distance of a depth buffer value
+float viewDepth(in float d) {
+	return projMat[3][2] / (d * 2.0 - 1.0 + projMat[2][2]);
+}
+
+// G-buffer texel of a window coordinate (the frame covers the bottom left
+// corner of the textures: no normalized lookup)
+ivec2 texel(in vec2 coord) {
+	return clamp(ivec2(coord * gbufferSize), ivec2(0), ivec2(gbufferSize) - 1);
+}
+
+float linearDepth(in vec2 coord) {
+	return viewDepth(texelFetch(depthmap, texel(coord), 0).x);
+}
+
+#if UPSCALE
+// window pixel from the lower resolution G-buffer: bilinear weights of the
+// 4 nearest texels, lowered for the ones whose depth or normal differ from
+// the closest texel (sharp silhouettes, no color bleeding across them)
+vec4 upscale(in vec2 coord) {
+	ivec2 size = ivec2(gbufferSize);
+	vec2 p = coord * gbufferSize - 0.5;
+	ivec2 base = ivec2(floor(p));
+	vec2 f = p - floor(p);
+
+	ivec2 nearest = texel(coord);
+	float zref = viewDepth(texelFetch(depthmap, nearest, 0).x);
+	vec3 nref = decodeNormal(texelFetch(normalmap, nearest, 0).xy);
+
+	vec4 sum = vec4(0.0);
+	float wsum = 0.0;
+	for (int k = 0; k < 4; ++k) {
+		ivec2 o = ivec2(k & 1, k >> 1);
+		ivec2 t = clamp(base + o, ivec2(0), size - 1);
+		float w = (o.x == 1 ? f.x : 1.0 - f.x) * (o.y == 1 ? f.y : 1.0 - f.y);
+
+		float z = viewDepth(texelFetch(depthmap, t, 0).x);
+		vec3 n = decodeNormal(texelFetch(normalmap, t, 0).xy);
+		w *= 1.0 / (1.0 + 50.0 * abs(z - zref) / zref);
+		w *= pow(max(dot(n, nref), 0.0), 8.0);
+
+		sum += w * texelFetch(colormap, t, 0);
+		wsum += w;
+	}
+
+	// (the nearest texel always has some weight unless it is exactly between)
+	return wsum > 1e-4 ? sum / wsum : texelFetch(colormap, nearest, 0);
+}
+#endif // UPSCALE
+
 void main() {
 	vec2 newcoord;
 
@@ -22,11 +93,18 @@ void main() {
 		newcoord = texcoord;
 	#endif // PIXEL_EFFECT
 
-	vec4 color = texture2D(colormap, newcoord);
+	#if TEMPORAL
+		ivec2 size = textureSize(colormap, 0);
+		vec4 color = texelFetch(colormap, clamp(ivec2(newcoord * vec2(size)), ivec2(0), size - 1), 0);
+	#elif UPSCALE
+		vec4 color = upscale(newcoord);
+	#else
+		vec4 color = texelFetch(colormap, texel(newcoord), 0);
+	#endif // TEMPORAL
 
 	#if FOG_EFFECT
 		vec4 fogcolor = vec4(vec3(0.8), 1.0);
-		float depth = max(0, min(1, texture2D(normalmap, newcoord).w));
+		float depth = clamp(linearDepth(newcoord) / 5, 0, 1);
 		outBuffer = (1 - depth) * color + depth * fogcolor;
 	#else
 		outBuffer = color;
@@ -1,6 +1,7 @@
 #version 330
 
-#define DROSOPHILA 0
+// DROSOPHILA (set by the viewer)
+#include "effects"
 
 // input attributes 
 layout(location = 0) in vec3 position;
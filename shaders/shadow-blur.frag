@@ -0,0 +1,56 @@
+#version 330
+
+out vec4 outMoments;
+
+uniform sampler2DArray depthmap; // cascade depths (full resolution, no comparison)
+uniform sampler2D momentmap;     // horizontally blurred moments (reduced resolution)
+uniform int layer;               // cascade
+uniform int fromDepth;           // 1: horizontal pass from the depths, 0: vertical pass
+uniform int evsm;                // exponential warp of the depths
+uniform vec2 evsmExponents;      // positive and negative warp exponents
+
+// 9-tap gaussian
+const float weights[5] = float[](0.2270270270, 0.1945945946, 0.1216216216, 0.0540540541, 0.0162162162);
+
+vec4 moments(in float d) {
+  if (evsm == 1) {
+    float p = exp(evsmExponents.x * d);
+    float n = -exp(-evsmExponents.y * d);
+    return vec4(p, p*p, n, n*n);
+  }
+  return vec4(d, d*d, 0.0, 0.0);
+}
+
+// mean moments of the 2x2 depths under a reduced texel
+// (the depths are not averaged before computing the moments)
+vec4 depthMoments(in ivec2 p) {
+  ivec2 q = 2 * clamp(p, ivec2(0), textureSize(depthmap, 0).xy / 2 - 1);
+  return 0.25 * (moments(texelFetch(depthmap, ivec3(q, layer), 0).r) +
+                 moments(texelFetch(depthmap, ivec3(q + ivec2(1, 0), layer), 0).r) +
+                 moments(texelFetch(depthmap, ivec3(q + ivec2(0, 1), layer), 0).r) +
+                 moments(texelFetch(depthmap, ivec3(q + ivec2(1, 1), layer), 0).r));
+}
+
+vec4 blurredMoments(in ivec2 p) {
+  ivec2 s = textureSize(momentmap, 0) - 1;
+  return texelFetch(momentmap, clamp(p, ivec2(0), s), 0);
+}
+
+void main() {
+  ivec2 p = ivec2(gl_FragCoord.xy);
+  vec4 m;
+
+  if (fromDepth == 1) {
+    m = weights[0] * depthMoments(p);
+    for (int i = 1; i < 5; ++i) {
+      m += weights[i] * (depthMoments(p + ivec2(i, 0)) + depthMoments(p - ivec2(i, 0)));
+    }
+  } else {
+    m = weights[0] * blurredMoments(p);
+    for (int i = 1; i < 5; ++i) {
+      m += weights[i] * (blurredMoments(p + ivec2(0, i)) + blurredMoments(p - ivec2(0, i)));
+    }
+  }
+
+  outMoments = m;
+}
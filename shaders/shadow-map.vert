@@ -4,13 +4,28 @@
 layout(location = 0) in vec3 position; 
 
 // input uniforms
-uniform mat4 mvpMat;
-uniform sampler2D heightmap;
+// light transform of the frame (shared with the terrain pass)
+layout(std140) uniform LightTransform {
+  mat4 lightMvp[4];    // world to light clip space of each cascade
+  mat4 shadowMat[4];   // world to [0,1] shadow map space of each cascade
+  vec4 cascadeSplits;  // far view distance of each cascade
+  int nbCascades;
+};
+uniform int cascade;
+uniform sampler2DArray heightmap;
+uniform vec2 tileOrigin;
+uniform float tileSize;
+uniform int tileLayer;
 
 void main() {
 	vec2 texcoord = position.xy * 0.5 + 0.5;
 	
+	// texel centers cover the whole tile (borders are shared)
+	vec2 res = vec2(textureSize(heightmap, 0).xy);
+	vec2 uv = (texcoord * (res - 1.0) + 0.5) / res;
+	
 	// on récupère la height dans la texture (n'importe quel canal)
-	float height = texture2D(heightmap, texcoord).x;
-  gl_Position =  mvpMat*vec4(position - vec3(0.0, 0.0, height),1);
+	float height = texture(heightmap, vec3(uv, tileLayer)).x;
+	vec3 pos = position + vec3(tileOrigin * tileSize, 0.0) - vec3(0.0, 0.0, height);
+  gl_Position =  lightMvp[cascade]*vec4(pos,1);
 }
@@ -1,9 +1,15 @@
 #version 330
 
+in vec2 texcoord;
+
 out vec4 outBuffer;
 
-uniform sampler2D shadowmap;
+uniform sampler2DArray shadowmap;
+uniform int nbCascades;
 
 void main() {
-  outBuffer = texelFetch(shadowmap,ivec2(gl_FragCoord.xy),0);
+  // the cascades are shown side by side, each stretched over its part of the window
+  int c = min(int(texcoord.x * nbCascades), nbCascades - 1);
+  vec2 uv = vec2(fract(texcoord.x * nbCascades), texcoord.y);
+  outBuffer = texelFetch(shadowmap,ivec3(uv*vec2(textureSize(shadowmap,0).xy),c),0);
 }
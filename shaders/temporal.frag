@@ -0,0 +1,55 @@
+#version 330
+
+// in variables (window coordinate)
+in vec2 texcoord;
+
+// input uniforms
+uniform sampler2D colormap;     // this frame, lower resolution and jittered
+uniform sampler2D depthmap;
+uniform sampler2D historymap;   // previous accumulation, window resolution
+uniform vec2 gbufferSize;       // frame size in colormap/depthmap
+uniform vec2 jitter;            // subpixel offset of this frame (gbuffer pixels)
+uniform mat4 reprojection;      // this frame clip space -> previous one (no jitter)
+uniform float reset;            // 1: no usable history
+
+out vec4 outBuffer;
+
+void main() {
+	// the gbuffer texel i has been shaded at the scene position i+0.5-jitter:
+	// nearest sample of the window pixel and its distance (window pixels)
+	vec2 q = texcoord * gbufferSize;
+	ivec2 maxTexel = ivec2(gbufferSize) - 1;
+	ivec2 i = clamp(ivec2(floor(q + jitter)), ivec2(0), maxTexel);
+	vec2 d = (q - (vec2(i) + 0.5 - jitter)) * 2.0;
+
+	// color bounds of the neighbourhood and closest depth (dilated silhouettes)
+	vec4 current = texelFetch(colormap, i, 0);
+	vec4 cmin = current;
+	vec4 cmax = current;
+	float depth = 1.0;
+	for (int y = -1; y <= 1; ++y) {
+		for (int x = -1; x <= 1; ++x) {
+			ivec2 t = clamp(i + ivec2(x, y), ivec2(0), maxTexel);
+			vec4 c = texelFetch(colormap, t, 0);
+			cmin = min(cmin, c);
+			cmax = max(cmax, c);
+			depth = min(depth, texelFetch(depthmap, t, 0).x);
+		}
+	}
+
+	// motion of the camera: where the pixel was in the previous frame
+	vec4 prev = reprojection * vec4(texcoord * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+	vec2 prevcoord = prev.xy / prev.w * 0.5 + 0.5;
+	bool outside = any(lessThan(prevcoord, vec2(0.0))) || any(greaterThan(prevcoord, vec2(1.0)));
+
+	// history clamped to the colors around (no ghost of what moved or disappeared)
+	vec4 history = clamp(texture(historymap, prevcoord), cmin, cmax);
+
+	// a sample close to the pixel center counts more
+	float alpha = max(0.5 * exp(-2.0 * dot(d, d)), 0.05);
+	if (reset > 0.5 || outside) {
+		alpha = 1.0;
+	}
+
+	outBuffer = mix(history, current, alpha);
+}
@@ -0,0 +1,12 @@
+#version 330
+
+// input attributes 
+layout(location = 0) in vec3 position;
+
+// out variables 
+out vec2 texcoord;
+
+void main() {
+  gl_Position = vec4(position, 1);
+  texcoord = position.xy * 0.5 + 0.5;
+}
@@ -4,21 +4,51 @@
 in vec3 normalView;
 in vec3 eyeView;
 in vec2 texcoord;
-in float depth;
 in float height;
-in vec4 shadcoord;
+in vec3 worldPos;
+in float viewDepth;
+in vec2 tileCoord;
+flat in int layer;
 
-uniform vec3 light;
+// per-frame constants (shared by all passes)
+layout(std140) uniform Frame {
+  mat4 mdvMat;      // modelview matrix
+  mat4 projMat;     // projection matrix
+  mat4 normalMat;   // normal matrix (3x3 part)
+  vec4 light;       // light direction (view space)
+  vec4 lightWorld;  // light direction (world space)
+  vec4 motion;      // motion offset of the noise
+};
 uniform sampler2D texWater;
-uniform sampler2D normalmap;
-uniform sampler2DShadow shadowmap;
+uniform sampler2DArrayShadow shadowmap; // one layer per cascade
+// light transform of the frame (the one the shadow pass used)
+layout(std140) uniform LightTransform {
+  mat4 lightMvp[4];    // world to light clip space of each cascade
+  mat4 shadowMat[4];   // world to [0,1] shadow map space of each cascade
+  vec4 cascadeSplits;  // far view distance of each cascade
+  int nbCascades;
+};
+uniform sampler2DArray momentmap;  // blurred and mipmapped moments (VSM/EVSM)
+uniform int shadowMode;            // 0: PCF, 1: VSM, 2: EVSM, 3: horizon maps
+uniform float shadowChordError;    // world height of the coarse shadow grid above this surface
+uniform vec2 evsmExponents;        // positive and negative warp exponents
+uniform sampler2DArray horizonmap; // horizon elevations (sines) of 8 azimuths, 2 layers per tile
+uniform int tileHorizon;           // the horizon map of the tile is available
 
-// out buffers
+// out buffers (RGBA8 color, RG16 octahedral normal; the linear depth is
+// reconstructed from the depth buffer)
 layout(location = 0) out vec4 outColorBuffer;
-layout(location = 1) out vec4 outNormalBuffer;
+layout(location = 1) out vec2 outNormalBuffer;
+
+// unit vector to the [0,1] square (octahedron unfolded on the z=0 plane)
+vec2 encodeNormal(in vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return e * 0.5 + 0.5;
+}
 
 // Phong shading
-vec4 shading(in vec2 coord, float height, vec3 n, sampler2D texture) {
+vec4 shading(in vec2 coord, float height, vec3 n, sampler2D texture, float ao) {
 	// remet entre 0 et 1 pour la couleur
 	float modifierColorHeight = max(0.4, (1 - (height + 0.1) * 5));
 	
@@ -29,24 +59,85 @@ vec4 shading(in vec2 coord, float height, vec3 n, sampler2D texture) {
   const float et = 100.0;
 
   vec3 e = normalize(eyeView);
-  vec3 l = normalize(light);
+  vec3 l = normalize(light.xyz);
   vec4 c = texture2D(texture, coord);
 
   float diff = max(dot(l,n), 0.0);
   float spec = pow(max(dot(reflect(l,n),e),0.0),et);
 
-  return vec4(ambient + diff*diffuse + spec*specular, 1.0) * c * modifierColorHeight;
+  return vec4(ao*ambient + diff*diffuse + spec*specular, 1.0) * c * modifierColorHeight;
+}
+
+// Chebyshev upper bound of the lit fraction, its tail is cut to reduce light bleeding
+float chebyshev(in vec2 m, in float d, in float minVariance) {
+	if (d <= m.x) {
+		return 1.0;
+	}
+	float variance = max(m.y - m.x*m.x, minVariance);
+	float dd = d - m.x;
+	float p = variance / (variance + dd*dd);
+	return clamp((p - 0.2) / 0.8, 0.0, 1.0);
 }
 
 void main() {
 	float v = 1.0;
-  float b = 0.05;
+	float ao = 1.0;
+	float horizonLit = 1.0;
 
 	vec3 n = normalize(normalView);
 	
-	// PCF
-  v -= 0.2 * (1.0 - texture(shadowmap, vec3(shadcoord.xy, (shadcoord.z - b) / shadcoord.w)));
+	// horizon maps: ambient occlusion from the mean horizon, and the horizon
+	// of the light azimuth (interpolated between the 2 closest ones)
+	if (tileHorizon == 1) {
+		vec2 res = vec2(textureSize(horizonmap, 0).xy);
+		vec2 uv = (tileCoord * (res - 1.0) + 0.5) / res;
+		vec4 h0 = texture(horizonmap, vec3(uv, 2*layer));
+		vec4 h1 = texture(horizonmap, vec3(uv, 2*layer + 1));
+		float horizons[8] = float[](h0.x, h0.y, h0.z, h0.w, h1.x, h1.y, h1.z, h1.w);
+		
+		ao = 1.0 - 0.125 * (dot(h0, vec4(1.0)) + dot(h1, vec4(1.0)));
+		
+		vec3 l = normalize(lightWorld.xyz);
+		float a = mod(atan(l.y, l.x) / 0.78539816, 8.0);
+		int a0 = int(a) % 8;
+		float horizon = mix(horizons[a0], horizons[(a0 + 1) % 8], fract(a));
+		horizonLit = smoothstep(horizon - 0.05, horizon + 0.05, l.z);
+	}
+	
+	// cascade covering this fragment
+	int c = 0;
+	for (int i = 0; i < nbCascades - 1; ++i) {
+		if (viewDepth > cascadeSplits[i]) {
+			c = i + 1;
+		}
+	}
+	vec4 shadcoord = shadowMat[c] * vec4(worldPos, 1.0);
+	
+	// the casters are the coarse grid, above this surface in concave areas (by
+	// more than the polygon offset covers): bias by its chord error in depth units
+	float b = shadowChordError * abs(shadowMat[c][2][2]);
+	
+	// one filtered fetch: hardware PCF or moments (the horizon needs none)
+	float lit;
+	if (shadowMode == 3) {
+		lit = horizonLit;
+	} else if (shadowMode == 0) {
+		lit = texture(shadowmap, vec4(shadcoord.xy, c, shadcoord.z - b));
+	} else {
+		vec4 m = texture(momentmap, vec3(shadcoord.xy, c));
+		float d = shadcoord.z - b;
+		const float minVariance = 0.00002;
+		if (shadowMode == 1) {
+			lit = chebyshev(m.xy, d, minVariance);
+		} else {
+			float p = exp(evsmExponents.x * d);
+			float n = -exp(-evsmExponents.y * d);
+			lit = min(chebyshev(m.xy, p, minVariance * evsmExponents.x * evsmExponents.x * p * p),
+			          chebyshev(m.zw, n, minVariance * evsmExponents.y * evsmExponents.y * n * n));
+		}
+	}
+  v -= 0.2 * (1.0 - lit);
 	
-	outColorBuffer = shading(texcoord, height, n, texWater) * v;
-	outNormalBuffer = vec4(n, depth);
+	outColorBuffer = shading(texcoord, height, n, texWater, ao) * v;
+	outNormalBuffer = encodeNormal(n);
 }
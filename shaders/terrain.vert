@@ -4,31 +4,49 @@
 layout(location = 0) in vec3 position;
 
 // input uniforms
-uniform mat4 mvpMat;
-uniform mat4 mdvMat;      // modelview matrix 
-uniform mat4 projMat;     // projection matrix
-uniform mat3 normalMat;   // normal matrix
+// per-frame constants (shared by all passes)
+layout(std140) uniform Frame {
+  mat4 mdvMat;      // modelview matrix
+  mat4 projMat;     // projection matrix
+  mat4 normalMat;   // normal matrix (3x3 part)
+  vec4 light;       // light direction (view space)
+  vec4 lightWorld;  // light direction (world space)
+  vec4 motion;      // motion offset of the noise
+};
 
-uniform sampler2D normalmap; // pour la height
+uniform sampler2DArray normalmap; // pour la height
+uniform vec2 tileOrigin;
+uniform float tileSize;
+uniform int tileLayer;
 
 // out variables
 out vec3 normalView;
 out vec3 eyeView;
 out vec2 texcoord;
-out float depth;
 out float height;
-out vec4 shadcoord;
+out vec3 worldPos;   // for the shadow cascades
+out float viewDepth;
+out vec2 tileCoord;  // for the horizon maps
+flat out int layer;
 
 void main() {
-	texcoord = position.xy * 0.5 + 0.5;
+	vec2 local = position.xy * 0.5 + 0.5;
+	texcoord = local + tileOrigin;
+	
+	// texel centers cover the whole tile (borders are shared)
+	vec2 res = vec2(textureSize(normalmap, 0).xy);
+	vec4 nh = texture(normalmap, vec3((local * (res - 1.0) + 0.5) / res, tileLayer));
 	
 	// on récupère la height dans la texture normalmap, canal alpha
-	height =  texture2D(normalmap, texcoord).w;
-	vec3 pos =  position - vec3(0.0, 0.0, height);
+	height = nh.w;
+	vec3 world = position + vec3(tileOrigin * tileSize, 0.0);
+	vec3 pos = world - vec3(0.0, 0.0, height);
 
   gl_Position = projMat*mdvMat*vec4(pos,1);
-  normalView  = normalize(normalMat * texture2D(normalmap, texcoord).xyz);
-  eyeView     = normalize((mdvMat * vec4(position, 1.0)).xyz);
-  depth				= -(mdvMat * vec4(pos, 1.0)).z / 5;
-  shadcoord		= mvpMat * vec4(pos, 1.0) * 0.5 + 0.5;
+  normalView  = normalize(mat3(normalMat) * nh.xyz);
+  eyeView     = normalize((mdvMat * vec4(world, 1.0)).xyz);
+  viewDepth		= -(mdvMat * vec4(pos, 1.0)).z;
+  worldPos		= pos;
+  tileCoord		= local;
+  layer				= tileLayer;
 }
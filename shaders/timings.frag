@@ -0,0 +1,9 @@
+#version 330
+
+out vec4 outBuffer;
+
+uniform vec4 color;
+
+void main() {
+  outBuffer = color;
+}
@@ -0,0 +1,11 @@
+#version 330
+
+// input attributes 
+layout(location = 0) in vec3 position;
+
+// bar of the overlay (x0,y0,x1,y1 in clip space)
+uniform vec4 rect;
+
+void main() {
+  gl_Position = vec4(mix(rect.xy,rect.zw,position.xy*0.5+0.5),0.0,1.0);
+}
@@ -0,0 +1,181 @@
+#include "simulation.h"
+#include "profiler.h"
+
+#include <QMutexLocker>
+#include <algorithm>
+#include <chrono>
+#include <limits.h>
+#include <math.h>
+
+using namespace std;
+
+// noise offset per second of animation (0.005 per frame at 60 Hz)
+static const float ANIMATION_SPEED = 0.3f;
+
+// camera step of the zqsd keys
+static const float MOVEMENT_SPEED = 10.0f;
+
+Simulation::Simulation(float len,float rate) :
+  _cam(new Camera(len,glm::vec3(0.0f,0.0f,0.0f))),
+  _light(glm::vec3(0,0,1)),
+  _motion(glm::vec3(0,0,0)),
+  _mode(false),
+  _animation(true),
+  _showShadowMap(false),
+  _currentTexture(0),
+  _width(0),
+  _height(0),
+  _step(0),
+  _moved(false),
+  _period(1.0f/max(rate,1.0f)),
+  _running(true) {
+
+}
+
+Simulation::~Simulation() {
+  stop();
+  delete _cam;
+}
+
+void Simulation::post(const Input &input) {
+  QMutexLocker locker(&_mutex);
+  _inputs.push_back(input);
+  _wake.wakeOne();
+}
+
+void Simulation::stop() {
+  {
+    QMutexLocker locker(&_mutex);
+    _running = false;
+    _wake.wakeOne();
+  }
+  wait();
+}
+
+const Simulation::State &Simulation::latest() {
+  _states.update();
+  return _states.front();
+}
+
+void Simulation::update(float dt) {
+  PROFILE_ZONE("Simulation::update");
+
+  vector<Input> inputs;
+  {
+    QMutexLocker locker(&_mutex);
+    inputs.swap(_inputs);
+  }
+
+  for(unsigned int i=0;i<inputs.size();++i) {
+    apply(inputs[i]);
+  }
+
+  if(_animation) {
+    _motion[0] -= ANIMATION_SPEED*dt;
+    _motion[1] -= ANIMATION_SPEED*dt;
+  }
+
+  // nothing changed: the last state stays the latest
+  if(inputs.empty() && !_animation && !_moved) return;
+
+  _moved = false;
+  publish();
+  if(_changed) _changed();
+}
+
+void Simulation::run() {
+  typedef chrono::steady_clock Clock;
+
+  Profiler::setThreadName("simulation");
+  Clock::time_point last = Clock::now();
+
+  QMutexLocker locker(&_mutex);
+  while(_running) {
+    // sleep until an input arrives or the next animation step
+    if(_inputs.empty()) {
+      _wake.wait(&_mutex,_animation ? (unsigned long)ceil(1000.0f*_period) : ULONG_MAX);
+    }
+    if(!_running) break;
+
+    locker.unlock();
+    const Clock::time_point now = Clock::now();
+    update(chrono::duration<float>(now-last).count());
+    last = now;
+    locker.relock();
+  }
+}
+
+void Simulation::apply(const Input &input) {
+  switch(input.type) {
+  case Input::RESIZE:
+    // the first size places the camera
+    _cam->initialize(input.width,input.height,_width==0);
+    _width  = input.width;
+    _height = input.height;
+    break;
+
+  case Input::MOUSE_PRESS:
+    if(input.button==Qt::LeftButton) {
+      _cam->initRotation(input.pos);
+      _mode = false;
+    } else if(input.button==Qt::MidButton) {
+      _cam->initMoveZ(input.pos);
+      _mode = false;
+    } else if(input.button==Qt::RightButton) {
+      moveLight(input.pos);
+      _mode = true;
+    }
+    break;
+
+  case Input::MOUSE_MOVE:
+    if(_mode) {
+      // light mode
+      moveLight(input.pos);
+    } else {
+      // camera mode
+      _cam->move(input.pos);
+    }
+    break;
+
+  case Input::KEY:
+    // keys zqsd: move camera
+    if(input.key==Qt::Key_Z) _cam->addZ(MOVEMENT_SPEED);
+    if(input.key==Qt::Key_S) _cam->addZ(-MOVEMENT_SPEED);
+    if(input.key==Qt::Key_Q) _cam->addX(MOVEMENT_SPEED);
+    if(input.key==Qt::Key_D) _cam->addX(-MOVEMENT_SPEED);
+
+    // key a: play/stop animation
+    if(input.key==Qt::Key_A) _animation = !_animation;
+
+    // key i: init camera
+    if(input.key==Qt::Key_I) _cam->initialize(_width,_height,true);
+
+    // key m: show the shadow map
+    if(input.key==Qt::Key_M) _showShadowMap = !_showShadowMap;
+
+    // key space: use the next texture
+    if(input.key==Qt::Key_Space) _currentTexture = (_currentTexture + 1) % 5;
+    break;
+  }
+}
+
+void Simulation::moveLight(const glm::vec2 &p) {
+  _light[0] = (p[0]-(float)(_width/2))/((float)(_width/2));
+  _light[1] = (p[1]-(float)(_height/2))/((float)(_height/2));
+  _light[2] = 1.0f-std::max(fabs(_light[0]),fabs(_light[1]));
+  _light = glm::normalize(_light);
+}
+
+void Simulation::publish() {
+  State &state = _states.back();
+  state.step           = ++_step;
+  state.mdvMat         = _cam->mdvMatrix();
+  state.projMat        = _cam->projMatrix();
+  state.normalMat      = _cam->normalMatrix();
+  state.light          = _light;
+  state.motion         = _motion;
+  state.animation      = _animation;
+  state.showShadowMap  = _showShadowMap;
+  state.currentTexture = _currentTexture;
+  _states.publish();
+}
@@ -0,0 +1,103 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+// OpenGL Mathematics
+#include <glm/glm.hpp>
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <functional>
+#include <vector>
+
+#include "camera.h"
+#include "triplebuffer.h"
+
+// Input handling and animation of the viewer, on their own thread. The
+// window events are queued by the GUI thread and applied as soon as they
+// arrive, the animation advances at a fixed rate; every change publishes
+// an immutable snapshot of what a frame needs (camera matrices, light,
+// motion, toggles). The render thread takes the latest snapshot from a
+// triple buffer: the input never waits for a frame to be drawn and a frame
+// never waits for the input.
+class Simulation : public QThread {
+ public:
+  // frame state (a copy per slot of the triple buffer, never shared)
+  struct State {
+    unsigned int step;          // update that published it (0: none yet)
+    glm::mat4    mdvMat;
+    glm::mat4    projMat;
+    glm::mat3    normalMat;
+    glm::vec3    light;         // view space
+    glm::vec3    motion;        // offset of the noise
+    bool         animation;
+    bool         showShadowMap;
+    int          currentTexture;
+  };
+
+  // window events
+  struct Input {
+    enum Type {RESIZE=0, MOUSE_PRESS=1, MOUSE_MOVE=2, KEY=3};
+
+    Type      type;
+    glm::vec2 pos;          // mouse position (pixels, y up)
+    int       button;       // Qt::MouseButton
+    int       key;          // Qt::Key
+    int       width,height; // window size
+
+    Input(Type t=KEY) : type(t),pos(0.0f),button(0),key(0),width(0),height(0) {}
+  };
+
+  Simulation(float len,float rate=240.0f);
+  ~Simulation();
+
+  // queue an input (any thread), applied at once by the running thread
+  void post(const Input &input);
+
+  // apply the queued inputs and dt seconds of animation, and publish the
+  // state if it changed (the thread does it, or the caller when not started)
+  void update(float dt);
+
+  // called by update after each publication (e.g. to request a frame)
+  inline void setChanged(const std::function<void()> &changed) {_changed = changed;}
+
+  // stop the thread and wait for it
+  void stop();
+
+  // latest published state (one reader thread)
+  const State &latest();
+
+  // camera of the simulation, published by the next update (only while
+  // the thread is not running)
+  inline Camera *camera() {_moved = true; return _cam;}
+
+ protected:
+  virtual void run();
+
+ private:
+  void apply(const Input &input);
+  void moveLight(const glm::vec2 &p);
+  void publish();
+
+  Camera      *_cam;
+  glm::vec3    _light;
+  glm::vec3    _motion;
+  bool         _mode;           // camera motion or light motion
+  bool         _animation;
+  bool         _showShadowMap;
+  int          _currentTexture;
+  int          _width,_height;
+  unsigned int _step;
+  bool         _moved;          // camera changed through camera()
+  float        _period;         // animation step (s)
+
+  QMutex             _mutex;
+  QWaitCondition     _wake;
+  std::vector<Input> _inputs;
+  bool               _running;
+
+  std::function<void()> _changed;
+  TripleBuffer<State>   _states;
+};
+
+#endif // SIMULATION_H
@@ -0,0 +1,248 @@
+// Shadow lookups of the LightTransform block: known world points are
+// transformed on the GPU by the block declaration of shaders/terrain.frag,
+// filled by LightTransform::upload, and compared with the texels and depths
+// expected from the light boxes (written by hand, not derived from the
+// matrices of the block). Run from the repository root:
+//   tests/lighttransform_test
+#include <GL/glew.h>
+
+#include <math.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lighttransform.h"
+#include "offscreencontext.h"
+#include "uniformring.h"
+
+using namespace std;
+
+static const int SHADOW_SIZE = 1024;
+
+// point of a light box: world position, expected map coordinates and depth
+struct Sample {
+  glm::vec3 p;
+  float u,v,depth;
+};
+
+struct Case {
+  const char *name;
+  int cascade;
+  glm::mat4 mvp;       // light view and orthographic box, column major
+  std::vector<Sample> samples;
+};
+
+static string readFile(const char *filename) {
+  ifstream file(filename);
+  stringstream s;
+  s << file.rdbuf();
+  return s.str();
+}
+
+static GLuint compile(GLenum type,const string &source) {
+  GLuint shader = glCreateShader(type);
+  const char *code = source.c_str();
+  glShaderSource(shader,1,&code,NULL);
+  glCompileShader(shader);
+
+  GLint ok = 0;
+  glGetShaderiv(shader,GL_COMPILE_STATUS,&ok);
+  if(!ok) {
+    char log[4096];
+    glGetShaderInfoLog(shader,sizeof(log),NULL,log);
+    cerr << log << endl;
+  }
+  return shader;
+}
+
+// light looking down -z: box x in [-2,2], y in [-1,3], depth 1 to 5 below the light
+static Case lightFromAbove() {
+  Case c;
+  c.name = "light from +z";
+  c.cascade = 2;
+  c.mvp = glm::mat4(0.5f,0.0f, 0.0f,0.0f,
+                    0.0f,0.5f, 0.0f,0.0f,
+                    0.0f,0.0f,-0.5f,0.0f,
+                    0.0f,-0.5f,-1.5f,1.0f);
+
+  const float points[][3] = {{0.0f,0.0f,-1.5f},{-1.9f,2.9f,-4.9f},{1.23f,-0.77f,-3.1f},{0.001f,1.5f,-2.0f}};
+  for(unsigned int k=0;k<sizeof(points)/sizeof(points[0]);++k) {
+    Sample s;
+    s.p = glm::vec3(points[k][0],points[k][1],points[k][2]);
+    s.u = (s.p[0]+2.0f)/4.0f;
+    s.v = (s.p[1]+1.0f)/4.0f;
+    s.depth = (-s.p[2]-1.0f)/4.0f;
+    c.samples.push_back(s);
+  }
+  return c;
+}
+
+// light looking down -x (map right: -z, up: +y): box -z in [-1,1], y in [0,2], depth 0 to 4
+static Case lightFromSide() {
+  Case c;
+  c.name = "light from +x";
+  c.cascade = 3;
+  c.mvp = glm::mat4( 0.0f,0.0f,-0.5f,0.0f,
+                     0.0f,1.0f, 0.0f,0.0f,
+                    -1.0f,0.0f, 0.0f,0.0f,
+                     0.0f,-1.0f,-1.0f,1.0f);
+
+  const float points[][3] = {{-0.5f,1.0f,0.0f},{-3.9f,0.1f,0.9f},{-2.2f,1.7f,-0.35f}};
+  for(unsigned int k=0;k<sizeof(points)/sizeof(points[0]);++k) {
+    Sample s;
+    s.p = glm::vec3(points[k][0],points[k][1],points[k][2]);
+    s.u = (-s.p[2]+1.0f)/2.0f;
+    s.v = s.p[1]/2.0f;
+    s.depth = -s.p[0]/4.0f;
+    c.samples.push_back(s);
+  }
+  return c;
+}
+
+int main() {
+  OffscreenContext context(3,3);
+  if(!context.valid() || !context.makeCurrent()) {
+    cerr << "Error: no offscreen OpenGL 3.3 context" << endl;
+    return 1;
+  }
+  if(glewInit()!=GLEW_OK) {
+    cerr << "Warning: glewInit failed!" << endl;
+  }
+
+  // the block as the terrain pass declares it
+  const string terrain = readFile("shaders/terrain.frag");
+  const size_t begin = terrain.find("layout(std140) uniform LightTransform");
+  const size_t end = terrain.find("};",begin);
+  if(begin==string::npos || end==string::npos) {
+    cerr << "Error: no LightTransform block in shaders/terrain.frag (run from the repository root)" << endl;
+    return 1;
+  }
+
+  const string vertex =
+    "#version 330\n"
+    "layout(location = 0) in vec3 position;\n" +
+    terrain.substr(begin,end+2-begin) + "\n"
+    "uniform int cascade;\n"
+    "out vec4 shadcoord;\n"
+    "out vec4 clip;\n"
+    "out vec4 splits;\n"
+    "void main() {\n"
+    "  shadcoord = shadowMat[cascade]*vec4(position,1.0);\n"
+    "  clip = lightMvp[cascade]*vec4(position,1.0);\n"
+    "  splits = vec4(cascadeSplits.xyz,float(nbCascades));\n"
+    "  gl_Position = vec4(0.0);\n"
+    "}\n";
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program,compile(GL_VERTEX_SHADER,vertex));
+  const char *varyings[] = {"shadcoord","clip","splits"};
+  glTransformFeedbackVaryings(program,3,varyings,GL_INTERLEAVED_ATTRIBS);
+  glLinkProgram(program);
+  GLint linked = 0;
+  glGetProgramiv(program,GL_LINK_STATUS,&linked);
+  if(!linked) {
+    cerr << "Error: test program not linked" << endl;
+    return 1;
+  }
+  glUniformBlockBinding(program,glGetUniformBlockIndex(program,"LightTransform"),LightTransform::BINDING);
+
+  // every cascade set: a wrong array stride reads the matrices of another one
+  std::vector<Case> cases;
+  cases.push_back(lightFromAbove());
+  cases.push_back(lightFromSide());
+
+  LightTransform transform;
+  for(int c=0;c<LightTransform::MAX_CASCADES;++c) {
+    transform.setCascade(c,glm::mat4(0.1f*(float)(c+1)));
+  }
+  for(unsigned int k=0;k<cases.size();++k) {
+    transform.setCascade(cases[k].cascade,cases[k].mvp);
+  }
+  transform.setSplits(glm::vec4(1.0f,2.0f,4.0f,8.0f),3);
+
+  UniformRing ring;
+  ring.beginFrame();
+  transform.upload(ring);
+
+  // (draws need a complete framebuffer, the context may have none)
+  GLuint fbo, color;
+  glGenFramebuffers(1,&fbo);
+  glGenRenderbuffers(1,&color);
+  glBindRenderbuffer(GL_RENDERBUFFER,color);
+  glRenderbufferStorage(GL_RENDERBUFFER,GL_RGBA8,1,1);
+  glBindFramebuffer(GL_FRAMEBUFFER,fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_RENDERBUFFER,color);
+
+  GLuint vao, buffers[2];
+  glGenVertexArrays(1,&vao);
+  glGenBuffers(2,buffers);
+  glBindVertexArray(vao);
+  glEnable(GL_RASTERIZER_DISCARD);
+  glUseProgram(program);
+
+  int failures = 0;
+  for(unsigned int k=0;k<cases.size();++k) {
+    const Case &c = cases[k];
+    const unsigned int n = (unsigned int)c.samples.size();
+
+    std::vector<float> positions;
+    for(unsigned int s=0;s<n;++s) {
+      positions.push_back(c.samples[s].p[0]);
+      positions.push_back(c.samples[s].p[1]);
+      positions.push_back(c.samples[s].p[2]);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER,buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER,positions.size()*sizeof(float),&positions[0],GL_STATIC_DRAW);
+    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,0,(void *)0);
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER,buffers[1]);
+    glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER,n*12*sizeof(float),NULL,GL_STATIC_READ);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER,0,buffers[1]);
+
+    glUniform1i(glGetUniformLocation(program,"cascade"),c.cascade);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS,0,n);
+    glEndTransformFeedback();
+
+    std::vector<float> out(n*12);
+    glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER,0,out.size()*sizeof(float),&out[0]);
+
+    for(unsigned int s=0;s<n;++s) {
+      const Sample &e = c.samples[s];
+      const float *lookup = &out[s*12];
+      const float *clip   = &out[s*12+4];
+      const float *splits = &out[s*12+8];
+
+      // lookup of the terrain pass, and where the shadow pass rendered the point
+      const float expected[3] = {e.u,e.v,e.depth};
+      bool ok = true;
+      for(int i=0;i<3;++i) {
+        const float rendered = clip[i]/clip[3]*0.5f+0.5f;
+        ok = ok && fabs(lookup[i]/lookup[3]-expected[i])<1e-5f && fabs(rendered-expected[i])<1e-5f;
+      }
+      for(int i=0;i<2;++i) {
+        ok = ok && (int)floor(lookup[i]/lookup[3]*SHADOW_SIZE)==(int)floor(expected[i]*SHADOW_SIZE);
+      }
+      ok = ok && splits[0]==1.0f && splits[1]==2.0f && splits[2]==4.0f && splits[3]==3.0f;
+
+      if(!ok) {
+        failures++;
+        cout << "FAILED " << c.name << ", point " << s << ": lookup (" << lookup[0] << "," << lookup[1] << "," << lookup[2]
+             << ") expected (" << e.u << "," << e.v << "," << e.depth << ")" << endl;
+      }
+    }
+  }
+
+  ring.endFrame();
+  glDeleteBuffers(2,buffers);
+  glDeleteVertexArrays(1,&vao);
+  glDeleteFramebuffers(1,&fbo);
+  glDeleteRenderbuffers(1,&color);
+  glDeleteProgram(program);
+
+  cout << (failures ? "lighttransform: FAILED" : "lighttransform: ok") << endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,17 @@
+# standalone test of the shadow lookups (no Qt): needs an EGL driver, run
+# from the repository root: qmake tests/lighttransform_test.pro && make && tests/lighttransform_test
+#GLEW_PATH = ../../../ext/glew-1.9.0
+GLM_PATH  = ../../../ext/glm-0.9.4.1
+
+TEMPLATE  = app
+TARGET    = lighttransform_test
+DESTDIR   = $$PWD
+
+LIBS     += -lGLEW -lGL -lEGL -lm
+INCLUDEPATH  += $$PWD/.. $${GLEW_PATH}/include $${GLM_PATH}
+
+SOURCES   = lighttransform_test.cpp ../lighttransform.cpp ../uniformring.cpp ../offscreencontext.cpp
+HEADERS   = ../lighttransform.h ../uniformring.h ../offscreencontext.h
+
+CONFIG   += console warn_on release c++11
+CONFIG   -= qt app_bundle
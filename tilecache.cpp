@@ -0,0 +1,110 @@
+#include "tilecache.h"
+
+#include <iostream>
+
+using namespace std;
+
+TileCache::TileCache(unsigned int nbLayers,unsigned int resol) :
+  _nbLayers(nbLayers),
+  _resol(resol) {
+
+  glGenFramebuffers(1,&_fbo);
+  glGenTextures(1,&_texNormal);
+  glGenTextures(1,&_texHeight);
+
+  // normals (xyz) and height (w) of each tile
+  glBindTexture(GL_TEXTURE_2D_ARRAY,_texNormal);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY,0,GL_RGBA32F,_resol,_resol,_nbLayers,0,GL_RGBA,GL_FLOAT,NULL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+
+  // heights of each tile
+  glBindTexture(GL_TEXTURE_2D_ARRAY,_texHeight);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY,0,GL_R32F,_resol,_resol,_nbLayers,0,GL_RED,GL_FLOAT,NULL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY,0);
+
+  // the fbo always writes in both maps
+  glBindFramebuffer(GL_FRAMEBUFFER,_fbo);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,_texNormal,0,0);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,_texHeight,0,0);
+  GLenum buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glDrawBuffers(2,buffers);
+
+  if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    cout << "Warning: tile FBO not complete!" << endl;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER,0);
+
+  clear();
+}
+
+TileCache::~TileCache() {
+  glDeleteFramebuffers(1,&_fbo);
+  glDeleteTextures(1,&_texNormal);
+  glDeleteTextures(1,&_texHeight);
+}
+
+void TileCache::clear() {
+  _tiles.clear();
+  _lru.clear();
+  _free.clear();
+
+  for(int l=(int)_nbLayers-1;l>=0;--l)
+    _free.push_back(l);
+}
+
+int TileCache::request(int i,int j,float stamp,bool &update) {
+  const Key k = key(i,j);
+  std::map<Key,Entry>::iterator it = _tiles.find(k);
+
+  if(it!=_tiles.end()) {
+    // resident: move it to the front of the LRU list
+    Entry &e = it->second;
+    _lru.splice(_lru.begin(),_lru,e.lru);
+    update = e.stamp!=stamp;
+    e.stamp = stamp;
+    return e.layer;
+  }
+
+  // not resident: take a free layer or evict the least recently visible tile
+  int layer;
+  if(!_free.empty()) {
+    layer = _free.back();
+    _free.pop_back();
+  } else {
+    std::map<Key,Entry>::iterator old = _tiles.find(_lru.back());
+    layer = old->second.layer;
+    _tiles.erase(old);
+    _lru.pop_back();
+  }
+
+  _lru.push_front(k);
+
+  Entry e;
+  e.layer = layer;
+  e.stamp = stamp;
+  e.lru   = _lru.begin();
+  _tiles[k] = e;
+
+  update = true;
+  return layer;
+}
+
+int TileCache::find(int i,int j,float stamp) const {
+  std::map<Key,Entry>::const_iterator it = _tiles.find(key(i,j));
+  return (it!=_tiles.end() && it->second.stamp==stamp) ? it->second.layer : -1;
+}
+
+void TileCache::bindLayer(int layer) {
+  glBindFramebuffer(GL_FRAMEBUFFER,_fbo);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,_texNormal,0,layer);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,_texHeight,0,layer);
+}
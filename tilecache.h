@@ -0,0 +1,63 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+// GLEW lib: needs to be included first!!
+#include <GL/glew.h>
+
+#include <list>
+#include <map>
+#include <vector>
+
+// Fixed-size cache of terrain tiles stored in texture arrays (one layer per
+// tile). Tiles are addressed by their integer coordinates and the least
+// recently visible one is evicted when a new tile needs a layer.
+class TileCache {
+ public:
+  TileCache(unsigned int nbLayers=32,unsigned int resol=256);
+  ~TileCache();
+
+  // layer storing tile (i,j), which becomes the most recently visible one.
+  // update is set when its maps have to be (re)generated: the tile was not
+  // resident or was generated with another stamp (animation time)
+  int request(int i,int j,float stamp,bool &update);
+
+  // layer of tile (i,j) without touching the LRU order
+  // (-1 if not resident or generated with another stamp)
+  int find(int i,int j,float stamp) const;
+
+  // forget every tile (e.g. when the terrain function changes)
+  void clear();
+
+  // bind the fbo with the given layer attached (normal: 0, height: 1)
+  void bindLayer(int layer);
+
+  inline unsigned int nbLayers() const {return _nbLayers;}
+  inline unsigned int resol()    const {return _resol;   }
+
+  inline GLuint normalmap() const {return _texNormal;}
+  inline GLuint heightmap() const {return _texHeight;}
+
+ private:
+  typedef long long Key;
+
+  struct Entry {
+    int                      layer;
+    float                    stamp;
+    std::list<Key>::iterator lru;
+  };
+
+  static inline Key key(int i,int j) {return ((Key)i<<32) ^ (Key)(unsigned int)j;}
+
+  unsigned int      _nbLayers;
+  unsigned int      _resol;
+
+  std::map<Key,Entry> _tiles;
+  std::list<Key>      _lru;   // front: most recently visible
+  std::vector<int>    _free;  // unused layers
+
+  GLuint _fbo;
+  GLuint _texNormal;
+  GLuint _texHeight;
+};
+
+#endif // TILECACHE_H
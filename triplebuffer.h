@@ -0,0 +1,46 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Latest value passed from one writer thread to one reader thread without
+// any lock: the writer fills its own slot then swaps it with the middle
+// one, the reader swaps its slot with the middle one when a newer value is
+// there. Neither ever waits for the other, the reader only skips the values
+// published faster than it reads them.
+template<typename T>
+class TripleBuffer {
+ public:
+  TripleBuffer(const T &value=T()) : _write(0),_read(2),_middle(1) {
+    _slots[0] = _slots[1] = _slots[2] = value;
+  }
+
+  // slot of the writer (writer thread)
+  inline T &back() {return _slots[_write];}
+
+  // make the back slot the latest value (writer thread)
+  inline void publish() {
+    _write = _middle.exchange(_write | FRESH,std::memory_order_acq_rel) & INDEX;
+  }
+
+  // take the latest value if a newer one was published (reader thread)
+  inline bool update() {
+    if(!(_middle.load(std::memory_order_acquire) & FRESH)) return false;
+    _read = _middle.exchange(_read,std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+
+  // value taken by the last update (reader thread)
+  inline const T &front() const {return _slots[_read];}
+
+ private:
+  static const unsigned int INDEX = 3;
+  static const unsigned int FRESH = 4; // the middle slot has not been read
+
+  T _slots[3];
+  unsigned int _write;
+  unsigned int _read;
+  std::atomic<unsigned int> _middle;
+};
+
+#endif // TRIPLEBUFFER_H
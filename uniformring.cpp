@@ -0,0 +1,92 @@
+#include "uniformring.h"
+
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+
+UniformRing::UniformRing(unsigned int frameSize,unsigned int nbFrames) :
+  _frameSize(frameSize),
+  _nbFrames(nbFrames),
+  _alignment(256),
+  _mapped(NULL),
+  _frame(0),
+  _offset(0),
+  _fences(nbFrames,(GLsync)0) {
+
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,&_alignment);
+
+  // sections start on an aligned offset
+  _frameSize = (_frameSize+_alignment-1)/_alignment*_alignment;
+
+  glGenBuffers(1,&_ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER,_ubo);
+
+  if(GLEW_ARB_buffer_storage || GLEW_VERSION_4_4) {
+    // immutable storage mapped once for the whole lifetime of the ring
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_UNIFORM_BUFFER,_frameSize*_nbFrames,NULL,flags);
+    _mapped = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER,0,_frameSize*_nbFrames,flags);
+    if(!_mapped) {
+      cout << "Warning: persistent uniform ring not mapped!" << endl;
+    }
+  } else {
+    glBufferData(GL_UNIFORM_BUFFER,_frameSize*_nbFrames,NULL,GL_DYNAMIC_DRAW);
+  }
+
+  glBindBuffer(GL_UNIFORM_BUFFER,0);
+}
+
+UniformRing::~UniformRing() {
+  for(unsigned int f=0;f<_nbFrames;++f) {
+    if(_fences[f]) glDeleteSync(_fences[f]);
+  }
+
+  if(_mapped) {
+    glBindBuffer(GL_UNIFORM_BUFFER,_ubo);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER,0);
+  }
+  glDeleteBuffers(1,&_ubo);
+}
+
+void UniformRing::beginFrame() {
+  _frame = (_frame+1)%_nbFrames;
+  _offset = 0;
+
+  // the GPU may still read the blocks written nbFrames ago
+  GLsync &fence = _fences[_frame];
+  if(fence) {
+    while(glClientWaitSync(fence,GL_SYNC_FLUSH_COMMANDS_BIT,1000000)==GL_TIMEOUT_EXPIRED) {}
+    glDeleteSync(fence);
+    fence = 0;
+  }
+}
+
+void UniformRing::endFrame() {
+  _fences[_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+}
+
+GLintptr UniformRing::push(const void *data,GLsizeiptr size) {
+  if(_offset+size>(GLintptr)_frameSize) {
+    cout << "Warning: uniform ring section full!" << endl;
+    return -1;
+  }
+
+  const GLintptr offset = _frame*_frameSize+_offset;
+  if(_mapped) {
+    memcpy(_mapped+offset,data,size);
+  } else {
+    glBindBuffer(GL_UNIFORM_BUFFER,_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER,offset,size,data);
+    glBindBuffer(GL_UNIFORM_BUFFER,0);
+  }
+
+  _offset += (size+_alignment-1)/_alignment*_alignment;
+  return offset;
+}
+
+void UniformRing::bind(GLuint binding,GLintptr offset,GLsizeiptr size) const {
+  if(offset>=0)
+    glBindBufferRange(GL_UNIFORM_BUFFER,binding,_ubo,offset,size);
+}
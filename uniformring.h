@@ -0,0 +1,46 @@
+#ifndef UNIFORMRING_H
+#define UNIFORMRING_H
+
+// GLEW lib: needs to be included first!!
+#include <GL/glew.h>
+
+#include <vector>
+
+// Uniform buffer split in one section per frame in flight. Each frame
+// writes its blocks in its own section (bound with glBindBufferRange), and
+// a section is only reused once the fence of its previous frame has passed,
+// so CPU writes never wait for the GPU to finish reading them.
+// The buffer is persistently mapped when ARB_buffer_storage is available
+// (plain glBufferSubData in the free section otherwise).
+class UniformRing {
+ public:
+  UniformRing(unsigned int frameSize=16384,unsigned int nbFrames=3);
+  ~UniformRing();
+
+  // move to the next section (waits for its previous frame only if the
+  // GPU is more than nbFrames late) / fence the current one
+  void beginFrame();
+  void endFrame();
+
+  // copy a block in the current section, returns its offset (-1 if full)
+  GLintptr push(const void *data,GLsizeiptr size);
+
+  // bind a pushed block to a uniform block binding point
+  void bind(GLuint binding,GLintptr offset,GLsizeiptr size) const;
+
+  inline bool persistent() const {return _mapped!=NULL;}
+
+ private:
+  unsigned int _frameSize;
+  unsigned int _nbFrames;
+  GLint        _alignment;
+
+  GLuint         _ubo;
+  unsigned char *_mapped;  // persistent mapping (NULL without buffer storage)
+
+  unsigned int        _frame;  // current section
+  GLintptr            _offset; // next free byte of the section
+  std::vector<GLsync> _fences;
+};
+
+#endif // UNIFORMRING_H
@@ -1,38 +1,159 @@
 #include "viewer.h"
 
 #include <math.h>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <sstream>
+#include <QCloseEvent>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QPaintEvent>
+#include <QResizeEvent>
 #include <QTime>
 
 using namespace std;
 
+// exponents of the EVSM depth warp (fp32 moments)
+static const glm::vec2 EVSM_EXPONENTS(40.0f, 5.0f);
+
+// element of the Halton sequence of a base, in [0,1)
+static float halton(unsigned int index,unsigned int base) {
+	float f = 1.0f, r = 0.0f;
+	while (index>0) {
+		f /= (float)base;
+		r += f*(float)(index%base);
+		index /= base;
+	}
+	return r;
+}
+
+// defines of the pp shaders for a mask of Viewer::PostEffect
+static std::string postEffectsCode(unsigned int effects) {
+	std::string code;
+	code += std::string("#define FOG_EFFECT ") + ((effects & Viewer::FOG_EFFECT) ? "1" : "0") + "\n";
+	code += std::string("#define PIXEL_EFFECT ") + ((effects & Viewer::PIXEL_EFFECT) ? "1" : "0") + "\n";
+	code += std::string("#define DROSOPHILA ") + ((effects & Viewer::DROSOPHILA_EFFECT) ? "1" : "0") + "\n";
+	code += std::string("#define UPSCALE ") + ((effects & Viewer::UPSCALE_EFFECT) ? "1" : "0") + "\n";
+	code += std::string("#define TEMPORAL ") + ((effects & Viewer::TEMPORAL_EFFECT) ? "1" : "0") + "\n";
+	return code;
+}
+
+// highest world height of the coarse grid above the fine one (vertices are
+// displaced by -height: where the coarse triangles cut a concave area), over
+// the tiles around the origin. The coarse surface is interpolated on the
+// triangles of the Grid, the terrain is evaluated on the CPU
+static float chordError(const NoiseGraph &graph,unsigned int fine,unsigned int coarse) {
+	const int radius = 1;
+	float error = 0.0f;
+	
+	std::vector<float> x(coarse*coarse), y(coarse*coarse), hc(coarse*coarse);
+	std::vector<float> fx(fine*fine), fy(fine*fine), hf(fine*fine);
+	for (int tj=-radius;tj<=radius;++tj) {
+		for (int ti=-radius;ti<=radius;++ti) {
+			// tile (i,j) covers [i,i+1]x[j,j+1] in the coordinates of the graph
+			for (unsigned int k=0;k<coarse*coarse;++k) {
+				x[k] = (float)ti + (float)(k%coarse)/(float)(coarse-1);
+				y[k] = (float)tj + (float)(k/coarse)/(float)(coarse-1);
+			}
+			for (unsigned int k=0;k<fine*fine;++k) {
+				fx[k] = (float)ti + (float)(k%fine)/(float)(fine-1);
+				fy[k] = (float)tj + (float)(k/fine)/(float)(fine-1);
+			}
+			graph.evaluate(&x[0], &y[0], 0.0f, &hc[0], coarse*coarse);
+			graph.evaluate(&fx[0], &fy[0], 0.0f, &hf[0], fine*fine);
+			
+			for (unsigned int k=0;k<fine*fine;++k) {
+				// cell of the coarse grid, split along its (x0,y0)-(x1,y1) diagonal
+				const float u = (float)(k%fine)/(float)(fine-1)*(float)(coarse-1);
+				const float v = (float)(k/fine)/(float)(fine-1)*(float)(coarse-1);
+				const unsigned int c0 = std::min((unsigned int)u, coarse-2);
+				const unsigned int r0 = std::min((unsigned int)v, coarse-2);
+				const float s = u-(float)c0, t = v-(float)r0;
+				const float h00 = hc[r0*coarse+c0], h10 = hc[r0*coarse+c0+1];
+				const float h01 = hc[(r0+1)*coarse+c0], h11 = hc[(r0+1)*coarse+c0+1];
+				const float h = s>=t ? h00 + s*(h10-h00) + t*(h11-h10)
+				                     : h00 + t*(h01-h00) + s*(h11-h01);
+				error = std::max(error, hf[k]-h);
+			}
+		}
+	}
+	return error;
+}
+
 Viewer::Viewer(char *,const QGLFormat &format)
   : QGLWidget(format),
-  	_timer(new QTimer(this)),
-    _light(glm::vec3(0,0,1)),
-    _motion(glm::vec3(0,0,0)),
-    _mode(false),
-    _showShadowMap(false),
-    _animation(true),
+  	_scheduler(new FrameScheduler(this)),
     _ndResol(64),
     _len(1.0),
-    _currentTexture(0) {
+    _width(0),
+    _height(0),
+    _terrainGraph(NoiseGraph::defaultTerrain()),
+    _viewTiles(2),
+    _noiseShader(NULL),
+    _minmaxShader(NULL),
+    _shadowMapShader(NULL),
+    _shadowBlurShader(NULL),
+    _debugShader(NULL),
+    _terrainShader(NULL),
+    _temporalShader(NULL),
+    _postProcessShaders(NULL),
+    _timingsShader(NULL),
+    _tiles(NULL),
+    _pyramid(NULL),
+    _horizons(NULL),
+    _fboShadow(0),
+    _shadowSize(1024),
+    _nbCascades(4),
+    _shadowFormat(GL_DEPTH_COMPONENT24),
+    _lightTransform(NULL),
+    _uniformRing(NULL),
+    _shadowDirty(true),
+    _skippedShadowPasses(0),
+    _shadowMode(SHADOW_PCF),
+    _postEffects(0),
+    _timedFrame(0),
+    _frameRate(60.0f),
+    _temporal(false),
+    _historyValid(false),
+    _fboHistory(0),
+    _historyIndex(0),
+    _historyWidth(0),
+    _historyHeight(0),
+    _jitterIndex(0),
+    _graph(NULL),
+    _gpuTimer(NULL),
+    _showTimings(false),
+    _capture(new FrameCapture()) {
 
   setlocale(LC_ALL,"C");
 
   _grid = new Grid(_ndResol, -_len, _len);
-  _cam  = new Camera(_len, glm::vec3(0.0f,0.0f,0.0f));
-
-  _timer->setInterval(1);
-  connect(_timer,SIGNAL(timeout()),this,SLOT(updateGL()));
+  _shadowGrid = new Grid(_ndResol/2, -_len, _len);
+  _shadowChordError = chordError(_terrainGraph, _ndResol, _ndResol/2);
+  
+  // camera, light and animation on the simulation thread, GL on the render thread
+  _simulation = new Simulation(_len);
+  _renderThread = new RenderThread(this);
+  _simulation->setChanged([this]() {
+    QMetaObject::invokeMethod(_scheduler, "requestFrame", Qt::QueuedConnection);
+  });
+
+  connect(_scheduler,SIGNAL(frame()),_renderThread,SLOT(requestFrame()),Qt::DirectConnection);
 }
 
 Viewer::~Viewer() {
-  delete _timer;
+  // the context is current again on this thread
+  stopRendering();
+  
+  delete _scheduler;
+  delete _simulation;
+  delete _renderThread;
   delete _grid;
-  delete _cam;
+  delete _shadowGrid;
 
-  // delete all GPU objects
+  // delete all GPU objects (the capture reads its frames in flight, then waits for its writer)
+  delete _capture;
   deleteShaders();
   deleteVAO();
 	deleteFBO();
@@ -46,132 +167,258 @@ void Viewer::deleteTextures() {
 
 void Viewer::deleteFBO() {
   // delete all FBO Ids
-  glDeleteFramebuffers(1, &_fboNoise);
-  glDeleteTextures(1, &_texNormal);
-  glDeleteTextures(1, &_texHeight);
+  delete _tiles;
+  delete _pyramid;
+  delete _lightTransform;
+  delete _uniformRing;
+  delete _horizons;
+  _tiles = NULL;
+  _pyramid = NULL;
+  _horizons = NULL;
+  _lightTransform = NULL;
+  _uniformRing = NULL;
+  delete _graph;
+  delete _gpuTimer;
+  _graph = NULL;
+  _gpuTimer = NULL;
   
   glDeleteFramebuffers(1, &_fboShadow);
   glDeleteTextures(1, &_texDepth);
   
-  glDeleteFramebuffers(1, &_fboTerrain);
-  glDeleteTextures(1, &_texTerrainColor);
-  glDeleteTextures(1, &_texTerrainNormal);
-  glDeleteTextures(1, &_texTerrainDepth);
+  glDeleteFramebuffers(1, &_fboMoments);
+  glDeleteTextures(1, &_texMoments);
+  glDeleteTextures(1, &_texMomentsTmp);
+  glDeleteSamplers(1, &_samplerDepth);
+  
+  glDeleteFramebuffers(1, &_fboHistory);
+  glDeleteTextures(2, _texHistory);
 }
 
 void Viewer::createFBO() {
   // generate fbo and associated textures
-  glGenFramebuffers(1, &_fboNoise);
-  glGenTextures(1, &_texNormal);
-  glGenTextures(1, &_texHeight);
+  // (the tile maps do not depend on the window size)
+  _tiles = new TileCache((2*_viewTiles+1)*(2*_viewTiles+1)+7, 256);
+  _pyramid = new HeightPyramid(_tiles->nbLayers(), _tiles->resol());
+  _lightTransform = new LightTransform();
+  _uniformRing = new UniformRing();
+  _horizons = new HorizonBaker(_terrainGraph, _tiles->nbLayers(), 64, 2.0f*_len);
+  // (the window sized textures are allocated by the render graph)
+  _graph = new RenderGraph();
+  _gpuTimer = new GpuTimer();
+  _graph->setTimer(_gpuTimer);
   
   glGenFramebuffers(1, &_fboShadow);
   glGenTextures(1, &_texDepth);
   
-  glGenFramebuffers(1, &_fboTerrain);
-  glGenTextures(1, &_texTerrainColor);
-  glGenTextures(1, &_texTerrainNormal);
-  glGenTextures(1, &_texTerrainDepth);
+  glGenFramebuffers(1, &_fboMoments);
+  glGenTextures(1, &_texMoments);
+  glGenTextures(1, &_texMomentsTmp);
+  glGenSamplers(1, &_samplerDepth);
+  glSamplerParameteri(_samplerDepth, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glSamplerParameteri(_samplerDepth, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glSamplerParameteri(_samplerDepth, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+  
+  // (the history is allocated with the first temporal frame)
+  glGenFramebuffers(1, &_fboHistory);
+  glGenTextures(2, _texHistory);
 }
 
-void Viewer::initFBO() {
-	/***************** _fboNoise *****************/
-	// create the texture for normal noise
-  glBindTexture(GL_TEXTURE_2D, _texNormal);
-  glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,width(),height(),0,GL_RGBA,GL_FLOAT,NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
-
-  // create the texture for height (generated in noise shader)
-  glBindTexture(GL_TEXTURE_2D, _texHeight);
-  glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,width(),height(),0,GL_RGBA,GL_FLOAT,NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
+void Viewer::setShadowMap(unsigned int size,GLenum format) {
+	// round the size up to a power of two
+	unsigned int s = 1;
+	while(s < size) {
+		s *= 2;
+	}
+	
+	runOnRenderThread([this,s,format]() {
+		_shadowSize = s;
+		_shadowFormat = format;
+		_shadowDirty = true;
+		
+		// only the shadow resources are reallocated (if already created)
+		if(_fboShadow) {
+			initShadowFBO();
+		}
+	});
+}
 
-  // attach textures to framebuffer object
-  glBindFramebuffer(GL_FRAMEBUFFER,_fboNoise);
-  
-  glBindTexture(GL_TEXTURE_2D, _texNormal);
-  glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_TEXTURE_2D,_texNormal,0);
-  
-  glBindTexture(GL_TEXTURE_2D, _texHeight);
-  glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,GL_TEXTURE_2D,_texHeight,0);
+void Viewer::setShadowMode(ShadowMode mode) {
+	runOnRenderThread([this,mode]() {
+		_shadowMode = mode;
+		_shadowDirty = true;
+		
+		// the moment maps depend on the mode
+		if(_fboShadow) {
+			initShadowFBO();
+		}
+	});
+}
 
-	glBindFramebuffer(GL_FRAMEBUFFER,0);
+void Viewer::startCapture(const std::string &filename) {
+	runOnRenderThread([this,filename]() {
+		if (_capture->start(filename, _frameRate)) {
+			cout << "capturing to " << filename << endl;
+		}
+	});
+}
+
+void Viewer::stopCapture() {
+	runOnRenderThread([this]() {
+		_capture->stop();
+	});
+}
+
+void Viewer::startRendering() {
+	// the context moves to the render thread: from now on, this thread
+	// only queues the input (simulation) and the frame requests
+	doneCurrent();
+	context()->moveToThread(_renderThread);
+	_renderThread->resize(width(), height());
+	_renderThread->start();
+	_simulation->start();
 	
+	_scheduler->setAsynchronous(true);
+	_scheduler->start();
+}
+
+void Viewer::stopRendering() {
+	if(!_renderThread->isRunning()) {
+		return;
+	}
+	
+	_scheduler->stop();
+	_simulation->stop();
+	_renderThread->stop();
+	makeCurrent();
+}
+
+void Viewer::runOnRenderThread(const std::function<void()> &command) {
+	// no render thread (not started yet, benchmark) or called by it: the caller owns the context
+	if(!_renderThread->isRunning() || QThread::currentThread()==_renderThread) {
+		command();
+		return;
+	}
+	
+	QMutexLocker locker(&_commandsMutex);
+	_commands.push_back(command);
+}
+
+void Viewer::runCommands() {
+	std::vector<std::function<void()> > commands;
+	{
+		QMutexLocker locker(&_commandsMutex);
+		commands.swap(_commands);
+	}
+	
+	for(unsigned int c=0;c<commands.size();++c) {
+		commands[c]();
+	}
+}
+
+void Viewer::initShadowFBO() {
 	/***************** _fboShadow *****************/
-	glBindTexture(GL_TEXTURE_2D, _texDepth);
-	glTexImage2D(GL_TEXTURE_2D,0,GL_DEPTH_COMPONENT24,width(),height(),0,GL_DEPTH_COMPONENT,GL_FLOAT,NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE); 
+	// one layer per cascade, its size and format do not depend on the window
+	// (linear filtering: hardware PCF)
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _texDepth);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY,0,_shadowFormat,_shadowSize,_shadowSize,_nbCascades,0,GL_DEPTH_COMPONENT,GL_FLOAT,NULL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE); 
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
   
-  // attach textures to framebuffer object
+  // the cascade layer is attached before rendering it
   glBindFramebuffer(GL_FRAMEBUFFER,_fboShadow);
-  
-  glBindTexture(GL_TEXTURE_2D, _texDepth);
-  glFramebufferTexture2D(GL_FRAMEBUFFER_EXT,GL_DEPTH_ATTACHMENT,GL_TEXTURE_2D,_texDepth,0);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,_texDepth,0,0);
 
 	glBindFramebuffer(GL_FRAMEBUFFER,0);
+	
+	/***************** _fboMoments *****************/
+	// blurred moments at half the shadow map size, mipmapped for the filtered
+	// fetch (2 moments for VSM, 4 for EVSM, a 1x1 placeholder otherwise)
+	const GLenum format = _shadowMode==SHADOW_EVSM ? GL_RGBA32F : GL_RG32F;
+	const unsigned int size = (_shadowMode==SHADOW_VSM || _shadowMode==SHADOW_EVSM) ? _shadowSize/2 : 1;
+	unsigned int nbLevels = 0;
+	
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _texMoments);
+	for(unsigned int s=size;s>=1;s/=2) {
+		glTexImage3D(GL_TEXTURE_2D_ARRAY,nbLevels++,format,s,s,_nbCascades,0,GL_RGBA,GL_FLOAT,NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, nbLevels-1);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
   
-	/***************** _fboTerrain *****************/
-	glBindTexture(GL_TEXTURE_2D, _texTerrainColor);
-  glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,width(),height(),0,GL_RGBA,GL_FLOAT,NULL);
+  glBindTexture(GL_TEXTURE_2D, _texMomentsTmp);
+  glTexImage2D(GL_TEXTURE_2D,0,format,size,size,0,GL_RGBA,GL_FLOAT,NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
-  
-  glBindTexture(GL_TEXTURE_2D, _texTerrainNormal);
-  glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32F,width(),height(),0,GL_RGBA,GL_FLOAT,NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
-	
-	glBindTexture(GL_TEXTURE_2D, _texTerrainDepth);
-	glTexImage2D(GL_TEXTURE_2D,0,GL_DEPTH_COMPONENT24,width(),height(),0,GL_DEPTH_COMPONENT,GL_FLOAT,NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE); 
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  
+  // the targets (temporary map or cascade layer) are attached before each pass
+  glBindFramebuffer(GL_FRAMEBUFFER,_fboMoments);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,_texMoments,0,0);
+  glDrawBuffer(GL_COLOR_ATTACHMENT0);
+  
+  if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    cout << "Warning: moments FBO not complete!" << endl;
+  }
+  
+  glBindFramebuffer(GL_FRAMEBUFFER,0);
+}
+
+void Viewer::initHistory() {
+	// accumulated frames at the window size, filtered for the reprojected
+	// fetch (the accumulation restarts)
+	_historyWidth = _width;
+	_historyHeight = _height;
+	_historyValid = false;
 	
-	// attach textures to framebuffer object
-	glBindFramebuffer(GL_FRAMEBUFFER,_fboTerrain);
+	for(int k=0;k<2;++k) {
+		glBindTexture(GL_TEXTURE_2D, _texHistory[k]);
+		glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA16F,_historyWidth,_historyHeight,0,GL_RGBA,GL_FLOAT,NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
 	
-	glBindTexture(GL_TEXTURE_2D, _texTerrainColor);
-  glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_TEXTURE_2D,_texTerrainColor,0);
-  
-  glBindTexture(GL_TEXTURE_2D, _texTerrainNormal);
-  glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT1,GL_TEXTURE_2D,_texTerrainNormal,0);
+	// the written texture is attached before each frame
+	glBindFramebuffer(GL_FRAMEBUFFER, _fboHistory);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _texHistory[0], 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
 	
-	glBindTexture(GL_TEXTURE_2D, _texTerrainDepth);
-  glFramebufferTexture2D(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_TEXTURE_2D,_texTerrainDepth,0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		cout << "Warning: history FBO not complete!" << endl;
+	}
 	
-  // test if everything is ok
-  if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-    cout << "Warning: FBO not complete!" << endl;
-  }
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-  // disable FBO
-  glBindFramebuffer(GL_FRAMEBUFFER,0);
+void Viewer::setPostEffects(unsigned int effects) {
+	runOnRenderThread([this,effects]() {
+		_postEffects = effects & ALL_EFFECTS;
+	});
+}
+
+void Viewer::setDynamicResolution(bool enabled) {
+	runOnRenderThread([this,enabled]() {
+		_resolution.setEnabled(enabled);
+	});
+}
+
+void Viewer::setTemporalUpsampling(bool enabled) {
+	runOnRenderThread([this,enabled]() {
+		_temporal = enabled;
+		_historyValid = false;
+	});
 }
 
 void Viewer::loadTexture(GLuint id, const char *filename) {
@@ -195,6 +442,8 @@ void Viewer::loadTexture(GLuint id, const char *filename) {
 }
 
 void Viewer::createTextures() {
+	PROFILE_ZONE("Viewer::createTextures");
+	
 	// generate texture ids
 	glGenTextures(5, _texWater);
 	
@@ -214,8 +463,10 @@ void Viewer::createVAO() {
 
   // cree les buffers associés au terrain 
   glGenBuffers(2, _terrain);
+  glGenBuffers(2, _shadowTerrain);
   glGenBuffers(1, &_quad);
   glGenVertexArrays(1, &_vaoTerrain);
+  glGenVertexArrays(1, &_vaoShadow);
   glGenVertexArrays(1, &_vaoQuad);
 
   // create the VBO associated with the grid (the terrain)
@@ -229,6 +480,17 @@ void Viewer::createVAO() {
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,_terrain[1]); // indices 
   glBufferData(GL_ELEMENT_ARRAY_BUFFER,_grid->nbFaces()*3*sizeof(int),_grid->faces(),GL_STATIC_DRAW);
   
+  // the coarser one (shadow maps do not need the camera mesh density)
+  glBindVertexArray(_vaoShadow);
+  
+  glBindBuffer(GL_ARRAY_BUFFER,_shadowTerrain[0]); // vertices 
+  glBufferData(GL_ARRAY_BUFFER,_shadowGrid->nbVertices()*3*sizeof(float),_shadowGrid->vertices(),GL_STATIC_DRAW);
+  glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,0,(void *)0);
+  glEnableVertexAttribArray(0);
+  
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,_shadowTerrain[1]); // indices 
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,_shadowGrid->nbFaces()*3*sizeof(int),_shadowGrid->faces(),GL_STATIC_DRAW);
+  
   glBindVertexArray(_vaoQuad);
   glBindBuffer(GL_ARRAY_BUFFER, _quad);
   glBufferData(GL_ARRAY_BUFFER, sizeof(quadData), quadData, GL_STATIC_DRAW);
@@ -240,146 +502,550 @@ void Viewer::createVAO() {
 
 void Viewer::deleteVAO() {
   glDeleteBuffers(2,_terrain);
+  glDeleteBuffers(2,_shadowTerrain);
   glDeleteBuffers(1, &_quad);
   glDeleteVertexArrays(1,&_vaoTerrain);
+  glDeleteVertexArrays(1,&_vaoShadow);
   glDeleteVertexArrays(1, &_vaoQuad);
 }
 
 void Viewer::createShaders() {
 	_noiseShader = new Shader();
+  _minmaxShader = new Shader();
   _shadowMapShader = new Shader();
+  _shadowBlurShader = new Shader();
   _debugShader = new Shader();
   _terrainShader = new Shader();
-  _postProcessShader = new Shader();
+  _temporalShader = new Shader();
+  _postProcessShaders = new ShaderPermutations("shaders/pp.vert","shaders/pp.frag","effects",postEffectsCode);
+  _timingsShader = new Shader();
+  
+  // terrain shape specialized from the noise graph
+  _noiseShader->setInclude("height",_terrainGraph.glsl());
+  
+  // uniform blocks (frame constants and cascade matrices)
+  _noiseShader->setBlockBinding("Frame",FRAME_BINDING);
+  _terrainShader->setBlockBinding("Frame",FRAME_BINDING);
+  _terrainShader->setBlockBinding("LightTransform",LightTransform::BINDING);
+  _shadowMapShader->setBlockBinding("LightTransform",LightTransform::BINDING);
+  _postProcessShaders->setBlockBinding("Frame",FRAME_BINDING);
   
   _noiseShader->load("shaders/noise.vert","shaders/noise.frag");
+  _minmaxShader->load("shaders/minmax.vert","shaders/minmax.frag");
   _shadowMapShader->load("shaders/shadow-map.vert","shaders/shadow-map.frag");
+  _shadowBlurShader->load("shaders/shadow-blur.vert","shaders/shadow-blur.frag");
   _debugShader->load("shaders/show-shadow-map.vert","shaders/show-shadow-map.frag");
   _terrainShader->load("shaders/terrain.vert","shaders/terrain.frag");
-  _postProcessShader->load("shaders/pp.vert","shaders/pp.frag");
+  _temporalShader->load("shaders/temporal.vert","shaders/temporal.frag");
+  
+  // pp programs of every effect combination, with and without upscaling
+  // (no effect at full resolution: no pp pass). The temporal ones are
+  // compiled when first used
+  std::vector<unsigned int> effects;
+  for (unsigned int e=1;e<=(ALL_EFFECTS|UPSCALE_EFFECT);++e) {
+    effects.push_back(e);
+  }
+  _postProcessShaders->precompile(effects);
+  
+  _timingsShader->load("shaders/timings.vert","shaders/timings.frag");
 }
 
 void Viewer::deleteShaders() {
 	delete _noiseShader;
+  delete _minmaxShader;
   delete _shadowMapShader;
+  delete _shadowBlurShader;
   delete _debugShader;
   delete _terrainShader;
-  delete _postProcessShader;
+  delete _temporalShader;
+  delete _postProcessShaders;
+  delete _timingsShader;
 
 	_noiseShader = NULL;
+	_minmaxShader = NULL;
 	_debugShader = NULL;
   _shadowMapShader = NULL;
+  _shadowBlurShader = NULL;
   _terrainShader = NULL;
-  _postProcessShader = NULL;
+  _temporalShader = NULL;
+  _postProcessShaders = NULL;
+  _timingsShader = NULL;
 }
 
 void Viewer::reloadShaders() {
+  // new programs: the uniform locations are reflected again
   if (_terrainShader) {
-    _noiseShader->load("shaders/noise.vert","shaders/noise.frag");
-		_shadowMapShader->load("shaders/shadow-map.vert","shaders/shadow-map.frag");
-		_debugShader->load("shaders/show-shadow-map.vert","shaders/show-shadow-map.frag");
-		_terrainShader->load("shaders/terrain.vert","shaders/terrain.frag");
-		_postProcessShader->load("shaders/pp.vert","shaders/pp.frag");
+    _noiseShader->reload("shaders/noise.vert","shaders/noise.frag");
+    _minmaxShader->reload("shaders/minmax.vert","shaders/minmax.frag");
+		_shadowMapShader->reload("shaders/shadow-map.vert","shaders/shadow-map.frag");
+		_shadowBlurShader->reload("shaders/shadow-blur.vert","shaders/shadow-blur.frag");
+		_debugShader->reload("shaders/show-shadow-map.vert","shaders/show-shadow-map.frag");
+		_terrainShader->reload("shaders/terrain.vert","shaders/terrain.frag");
+		_temporalShader->reload("shaders/temporal.vert","shaders/temporal.frag");
+		_postProcessShaders->reload();
+		_timingsShader->reload("shaders/timings.vert","shaders/timings.frag");
+		_shadowDirty = true;
 	}
 }
 
-void Viewer::animation() {
-	const float animationStep = 0.005;
+void Viewer::uploadFrame(const glm::vec2 &jitter) {
+	// camera, light and motion of this frame, bound once for all the passes
+	FrameBlock frame;
+	frame.mdvMat     = _state.mdvMat;
+	frame.projMat    = glm::translate(glm::mat4(1.0f), glm::vec3(jitter, 0.0f))*_state.projMat;
+	frame.normalMat  = glm::mat4(_state.normalMat);
+	frame.light      = glm::vec4(_state.light, 0.0f);
+	frame.lightWorld = glm::vec4(glm::normalize(glm::transpose(_state.normalMat)*_state.light), 0.0f);
+	frame.motion     = glm::vec4(_state.motion, 0.0f);
 	
-  _motion[0] -= animationStep;
-  _motion[1] -= animationStep;
+	_uniformRing->bind(FRAME_BINDING, _uniformRing->push(&frame, sizeof(frame)), sizeof(frame));
 }
 
-void Viewer::drawNoise(GLuint id) {
-	// send uniform variables
-  glUniform3fv(glGetUniformLocation(id,"motion"),1,&(_motion[0]));
+void Viewer::updateResolution() {
+	// budget: the target period, or 60 Hz with vsync
+	_resolution.setBudget(1000.0f/_frameRate);
+	
+	// once per collected frame (a few frames late): only the terrain scales with the resolution
+	if (_gpuTimer->lastFrame()!=_timedFrame) {
+		_timedFrame = _gpuTimer->lastFrame();
+		_resolution.update(_gpuTimer->lastFrameTime(), _gpuTimer->lastFrameTime("terrain"));
+	}
+}
 
-	drawQuad();
+void Viewer::updateTiles() {
+	const float size = 2.0f*_len;
+	const glm::mat4 mvp = _state.projMat*_state.mdvMat;
+	
+	// camera position projected on the terrain plane
+	const glm::vec4 eye = glm::inverse(_state.mdvMat)*glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	const int ci = (int)floor((eye[0]+_len)/size);
+	const int cj = (int)floor((eye[1]+_len)/size);
+	
+	_loadedTiles.clear();
+	_visibleTiles.clear();
+	_dirtyTiles.clear();
+	
+	// request all the tiles around the camera (the cache holds all of them):
+	// the ones outside the view may still cast shadows on the visible ones
+	for(int j=cj-_viewTiles;j<=cj+_viewTiles;++j) {
+		for(int i=ci-_viewTiles;i<=ci+_viewTiles;++i) {
+			bool update = false;
+			const int layer = _tiles->request(i, j, _state.motion[0], update);
+			
+			// a reused layer still has the bounds of its previous tile: the
+			// conservative ones until the new chain is read back
+			if(update) {
+				_pyramid->invalidate(layer);
+			}
+			
+			_loadedTiles.push_back(glm::ivec3(i, j, layer));
+			if(tileVisible(mvp, i, j)) {
+				_visibleTiles.push_back(glm::ivec3(i, j, layer));
+			}
+			if(update) {
+				_dirtyTiles.push_back(glm::ivec3(i, j, layer));
+				_horizons->request(i, j, layer, _state.motion[0]);
+			}
+		}
+	}
+}
+
+void Viewer::tileBounds(int i,int j,float &hmin,float &hmax) const {
+	// conservative terrain height bounds, refined by the min/max pyramid
+	// when the tile is up to date and its bounds have been read back
+	hmin = -0.25f;
+	hmax = 0.25f;
+	_pyramid->bounds(_tiles->find(i, j, _state.motion[0]), hmin, hmax);
+}
+
+bool Viewer::tileVisible(const glm::mat4 &mvp,int i,int j) const {
+	const float size = 2.0f*_len;
+	
+	float hmin, hmax;
+	tileBounds(i, j, hmin, hmax);
+	
+	// the tile box is culled when its 8 corners are outside the same clip plane
+	// (vertices are displaced by -height)
+	int outside[6] = {0, 0, 0, 0, 0, 0};
+	for(int c=0;c<8;++c) {
+		const glm::vec4 p((float)i*size + ((c&1) ? _len : -_len),
+		                  (float)j*size + ((c&2) ? _len : -_len),
+		                  (c&4) ? -hmin : -hmax, 1.0f);
+		const glm::vec4 q = mvp*p;
+		
+		for(int k=0;k<3;++k) {
+			if(q[k] < -q[3]) outside[2*k]++;
+			if(q[k] >  q[3]) outside[2*k+1]++;
+		}
+	}
+	
+	for(int k=0;k<6;++k) {
+		if(outside[k]==8) {
+			return false;
+		}
+	}
+	
+	return true;
 }
 
-void Viewer::drawSceneFromLight(GLuint id) {
-	// mdv matrix from the light point of view
-	const float size = _cam->getRadius() * 2;
-	glm::vec3 l = glm::transpose(_cam->normalMatrix())*_light;
-	glm::mat4 p = glm::ortho<float>(-size, size, -size, size, -size, 2*size);
-	glm::mat4 v = glm::lookAt(l, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-	glm::mat4 m = glm::mat4(1.0);
-	glm::mat4 mv = v*m;
+void Viewer::drawNoise(Shader *shader) {
+	// send uniform variables
+  shader->setUniform(Shader::hash("tileResol"), (float)_tiles->resol());
 
-	const glm::mat4 mvp = p*mv;
-	glUniformMatrix4fv(glGetUniformLocation(id, "mvpMat"), 1, GL_FALSE, &mvp[0][0]);
+	// write in the layers of the tiles that became visible (or are animated)
+	for(unsigned int k=0;k<_dirtyTiles.size();++k) {
+		_tiles->bindLayer(_dirtyTiles[k][2]);
+		shader->setUniform(Shader::hash("tileOrigin"), glm::vec2((float)_dirtyTiles[k][0],(float)_dirtyTiles[k][1]));
+		drawQuad();
+	}
+}
 
-	// send the height map
+void Viewer::drawMinMax(Shader *shader) {
+	// sources: height maps for level 0, previous level otherwise
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, _texHeight);
-	glUniform1i(glGetUniformLocation(id, "heightmap"), 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _tiles->heightmap());
+	shader->setUniform(Shader::hash("heightmap"), 0);
+	
+	// (bound by bindLevel, with the source level only)
+	glActiveTexture(GL_TEXTURE0 + 1);
+	shader->setUniform(Shader::hash("minmax"), 1);
+	
+	// rebuild the chains of the tiles generated this frame only
+	for(unsigned int k=0;k<_dirtyTiles.size();++k) {
+		const int layer = _dirtyTiles[k][2];
+		shader->setUniform(Shader::hash("layer"), layer);
+		
+		for(unsigned int l=0;l<_pyramid->nbLevels();++l) {
+			const unsigned int s = _pyramid->bindLevel(layer, l);
+			glViewport(0, 0, s, s);
+			shader->setUniform(Shader::hash("level"), (int)l);
+			drawQuad();
+		}
+		
+		_pyramid->invalidate(layer);
+	}
+	_pyramid->restoreLevels();
+}
 
-  // draw the terrain
-  glBindVertexArray(_vaoTerrain);
-  glDrawElements(GL_TRIANGLES,3*_grid->nbFaces(),GL_UNSIGNED_INT,(void *)0);
+void Viewer::drawTiles(Shader *shader,GLuint vao,const Grid *grid,const std::vector<glm::ivec3> &tiles) {
+	shader->setUniform(Shader::hash("tileSize"), 2.0f*_len);
+	
+	// the grid is drawn once per tile
+  glBindVertexArray(vao);
+	for(unsigned int k=0;k<tiles.size();++k) {
+		shader->setUniform(Shader::hash("tileOrigin"), glm::vec2((float)tiles[k][0],(float)tiles[k][1]));
+		shader->setUniform(Shader::hash("tileLayer"), tiles[k][2]);
+		shader->setUniform(Shader::hash("tileHorizon"), _horizons->ready(tiles[k][2],tiles[k][0],tiles[k][1]));
+		glDrawElements(GL_TRIANGLES,3*grid->nbFaces(),GL_UNSIGNED_INT,(void *)0);
+	}
   glBindVertexArray(0);
 }
 
-void Viewer::drawShadowMap(GLuint id) {
+void Viewer::heightBounds(float &hmin,float &hmax) const {
+	// union of the visible tile bounds (conservative if one is unknown)
+	hmin = 1e9f;
+	hmax = -1e9f;
+	
+	for(unsigned int k=0;k<_visibleTiles.size();++k) {
+		float tmin, tmax;
+		if(!_pyramid->bounds(_tiles->find(_visibleTiles[k][0], _visibleTiles[k][1], _state.motion[0]), tmin, tmax)) {
+			hmin = -0.25f;
+			hmax = 0.25f;
+			return;
+		}
+		hmin = std::min(hmin, tmin);
+		hmax = std::max(hmax, tmax);
+	}
+}
+
+unsigned int Viewer::updateCascades(bool force) {
+	const glm::mat4 proj = _state.projMat;
+	const glm::mat4 invMdv = glm::inverse(_state.mdvMat);
+	
+	// camera near plane and shadow distance (the loaded tiles), from the projection
+	const float znear = proj[3][2]/(proj[2][2]-1.0f);
+	const float zfar  = std::min(proj[3][2]/(proj[2][2]+1.0f), (float)(2*_viewTiles+1)*_len);
+	
+	// terrain slab (vertices are displaced by -height)
+	float hmin, hmax;
+	heightBounds(hmin, hmax);
+	const float zlo = -hmax;
+	const float zhi = -hmin;
+	
+	// light view, looking along the light direction (given in view space)
+	const glm::vec3 l = glm::normalize(glm::transpose(_state.normalMat)*_state.light);
+	const glm::vec3 up = fabs(l[1]) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+	const glm::mat4 lightView = glm::lookAt(glm::vec3(0, 0, 0), -l, up);
+	
+	// light space boxes of the loaded tiles (the potential casters)
+	std::vector<glm::vec3> casterMin(_loadedTiles.size(), glm::vec3(1e9f));
+	std::vector<glm::vec3> casterMax(_loadedTiles.size(), glm::vec3(-1e9f));
+	for(unsigned int k=0;k<_loadedTiles.size();++k) {
+		float tmin, tmax;
+		tileBounds(_loadedTiles[k][0], _loadedTiles[k][1], tmin, tmax);
+		for(int c=0;c<8;++c) {
+			const glm::vec4 p((float)_loadedTiles[k][0]*2.0f*_len + ((c&1) ? _len : -_len),
+			                  (float)_loadedTiles[k][1]*2.0f*_len + ((c&2) ? _len : -_len),
+			                  (c&4) ? -tmin : -tmax, 1.0f);
+			const glm::vec3 q = glm::vec3(lightView*p);
+			casterMin[k] = glm::min(casterMin[k], q);
+			casterMax[k] = glm::max(casterMax[k], q);
+		}
+	}
+	
+	glm::vec4 splits(0.0f);
+	unsigned int render = 0;
+	
+	for(int c=0;c<_nbCascades;++c) {
+		// practical split scheme: mix of logarithmic and uniform splits
+		const float lambda = 0.75f;
+		const float t = (float)(c+1)/(float)_nbCascades;
+		const float d0 = c==0 ? znear : splits[c-1];
+		const float d1 = lambda*znear*pow(zfar/znear, t) + (1.0f-lambda)*(znear + (zfar-znear)*t);
+		splits[c] = d1;
+		
+		// world corners of the frustum slice
+		glm::vec3 corners[8];
+		for(int k=0;k<8;++k) {
+			const float d = (k&4) ? d1 : d0;
+			const glm::vec4 p(((k&1) ? d : -d)/proj[0][0], ((k&2) ? d : -d)/proj[1][1], -d, 1.0f);
+			corners[k] = glm::vec3(invMdv*p);
+		}
+		
+		// fit to the part of the slice inside the terrain slab: corners
+		// inside it and intersections of the 12 edges with its planes
+		std::vector<glm::vec3> points;
+		for(int k=0;k<8;++k) {
+			if(corners[k][2] >= zlo && corners[k][2] <= zhi) {
+				points.push_back(corners[k]);
+			}
+			for(int b=1;b<8;b*=2) {
+				if(k&b) continue;
+				const glm::vec3 &a = corners[k];
+				const glm::vec3 &e = corners[k|b];
+				const float planes[2] = {zlo, zhi};
+				for(int s=0;s<2;++s) {
+					const float u = (planes[s]-a[2])/(e[2]-a[2]);
+					if(e[2]!=a[2] && u >= 0.0f && u <= 1.0f) {
+						points.push_back(a + (e-a)*u);
+					}
+				}
+			}
+		}
+		if(points.empty()) {
+			points.assign(corners, corners+8);
+		}
+		
+		glm::vec3 bmin(1e9f), bmax(-1e9f);
+		for(unsigned int k=0;k<points.size();++k) {
+			const glm::vec3 q = glm::vec3(lightView*glm::vec4(points[k], 1.0f));
+			bmin = glm::min(bmin, q);
+			bmax = glm::max(bmax, q);
+		}
+		
+		// fixed size square (the bounding sphere of the slice, which does not
+		// change with the camera rotation nor the height bounds) centered on
+		// the fitted box and snapped to shadow texels, so that the map does
+		// not shimmer (half a texel of margin for the snap)
+		glm::vec3 center(0.0f);
+		for(int k=0;k<8;++k) {
+			center += corners[k]/8.0f;
+		}
+		float radius = 0.0f;
+		for(int k=0;k<8;++k) {
+			radius = std::max(radius, glm::length(corners[k]-center));
+		}
+		radius = ceil(radius*64.0f)/64.0f;
+		const float texel = 2.0f*radius/(float)(_shadowSize-1);
+		for(int k=0;k<2;++k) {
+			const float middle = floor(0.5f*(bmin[k]+bmax[k])/texel + 0.5f)*texel;
+			bmin[k] = middle - 0.5f*texel*(float)_shadowSize;
+			bmax[k] = middle + 0.5f*texel*(float)_shadowSize;
+		}
+		
+		// casters: the loaded tiles over the box, on the light side of its far
+		// plane (visible or not); the box is extended towards the light to keep them
+		_casterTiles[c].clear();
+		float casterZ = -1e9f;
+		for(unsigned int k=0;k<_loadedTiles.size();++k) {
+			if(casterMax[k][0] < bmin[0] || casterMin[k][0] > bmax[0] ||
+			   casterMax[k][1] < bmin[1] || casterMin[k][1] > bmax[1] ||
+			   casterMax[k][2] < bmin[2]) {
+				continue;
+			}
+			_casterTiles[c].push_back(_loadedTiles[k]);
+			casterZ = std::max(casterZ, casterMax[k][2]);
+		}
+		const float zmax = std::max(bmax[2], casterZ);
+		const glm::mat4 p = glm::ortho<float>(bmin[0], bmax[0], bmin[1], bmax[1], -zmax, -bmin[2]);
+		const glm::mat4 mvp = p*lightView;
+		
+		// a cached cascade is only re-rendered when its light matrix changed
+		// (light direction or view slice) or when forced
+		if(!force && mvp == _lightTransform->mvp(c)) {
+			continue;
+		}
+		_lightTransform->setCascade(c, mvp);
+		render |= 1u<<c;
+	}
+	
+	_lightTransform->setSplits(splits, _nbCascades);
+	return render;
+}
+
+void Viewer::drawSceneFromLight(Shader *shader,int cascade) {
+	// the cascade matrix is read from the light transform block
+	shader->setUniform(Shader::hash("cascade"), cascade);
+
+	// send the height maps
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _tiles->heightmap());
+	shader->setUniform(Shader::hash("heightmap"), 0);
+
+  // draw the terrain (coarse grid)
+  drawTiles(shader, _vaoShadow, _shadowGrid, _casterTiles[cascade]);
+}
+
+void Viewer::drawShadowBlur(Shader *shader,int cascade) {
+	shader->setUniform(Shader::hash("layer"), cascade);
+	shader->setUniform(Shader::hash("evsm"), _shadowMode==SHADOW_EVSM);
+	shader->setUniform(Shader::hash("evsmExponents"), EVSM_EXPONENTS);
+	shader->setUniform(Shader::hash("depthmap"), 0);
+	shader->setUniform(Shader::hash("momentmap"), 1);
+	
+	glViewport(0, 0, _shadowSize/2, _shadowSize/2);
+	glBindFramebuffer(GL_FRAMEBUFFER, _fboMoments);
+	
+	// horizontal pass: moments of the cascade depths, at half resolution
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _texDepth);
+	glBindSampler(0, _samplerDepth);
+	glActiveTexture(GL_TEXTURE0 + 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _texMomentsTmp, 0);
+	shader->setUniform(Shader::hash("fromDepth"), 1);
+	drawQuad();
+	
+	// vertical pass: in the first level of the cascade layer
+	glBindTexture(GL_TEXTURE_2D, _texMomentsTmp);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _texMoments, 0, cascade);
+	shader->setUniform(Shader::hash("fromDepth"), 0);
+	drawQuad();
+	
+	glBindSampler(0, 0);
+}
+
+void Viewer::drawShadowMap(Shader *shader) {
 	// send depth texture
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, _texDepth);
-	glUniform1i(glGetUniformLocation(id, "shadowmap"), 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _texDepth);
+	shader->setUniform(Shader::hash("shadowmap"), 0);
+	shader->setUniform(Shader::hash("nbCascades"), _nbCascades);
 	
 	drawQuad();
 }
 
-void Viewer::drawSceneFromCamera(GLuint id) {
-	// mdv matrix from the light point of view
-	const float size = _cam->getRadius();
-	glm::vec3 l = glm::transpose(_cam->normalMatrix())*_light;
-	glm::mat4 p = glm::ortho<float>(-size, size, -size, size, -size, 2*size);
-	glm::mat4 v = glm::lookAt(l, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-	glm::mat4 m = glm::mat4(1.0);
-	glm::mat4 mv = v*m;
-	glm::mat4 mvp = p*mv;
-	
-  // send uniform variables 
-  glUniformMatrix3fv(glGetUniformLocation(id,"mvpMat"),1,GL_FALSE, &mvp[0][0]);
-  glUniformMatrix4fv(glGetUniformLocation(id,"mdvMat"),1,GL_FALSE,&(_cam->mdvMatrix()[0][0]));
-  glUniformMatrix4fv(glGetUniformLocation(id,"projMat"),1,GL_FALSE,&(_cam->projMatrix()[0][0]));
-  glUniformMatrix3fv(glGetUniformLocation(id,"normalMat"),1,GL_FALSE,&(_cam->normalMatrix()[0][0]));
-  glUniform3fv(glGetUniformLocation(id,"light"),1,&(_light[0]));
-  glUniform3fv(glGetUniformLocation(id,"motion"),1,&(_motion[0]));
+void Viewer::drawSceneFromCamera(Shader *shader) {
+  // camera, light and motion come from the frame block, the cascades from the light transform block
 
 	// send textures (imported & fbo)
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, _texWater[_currentTexture]);
-	glUniform1i(glGetUniformLocation(id, "texWater"), 0);
+	glBindTexture(GL_TEXTURE_2D, _texWater[_state.currentTexture]);
+	shader->setUniform(Shader::hash("texWater"), 0);
 	
 	glActiveTexture(GL_TEXTURE0 + 1);
-	glBindTexture(GL_TEXTURE_2D, _texNormal);
-	glUniform1i(glGetUniformLocation(id, "normalmap"), 1);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _tiles->normalmap());
+	shader->setUniform(Shader::hash("normalmap"), 1);
 	
 	glActiveTexture(GL_TEXTURE0 + 2);
-	glBindTexture(GL_TEXTURE_2D, _texDepth);
-	glUniform1i(glGetUniformLocation(id, "shadowmap"), 2);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _texDepth);
+	shader->setUniform(Shader::hash("shadowmap"), 2);
+	
+	glActiveTexture(GL_TEXTURE0 + 3);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _texMoments);
+	shader->setUniform(Shader::hash("momentmap"), 3);
+	shader->setUniform(Shader::hash("shadowMode"), _shadowMode);
+	// (with a margin: the terrain moves, the chord error is measured once)
+	shader->setUniform(Shader::hash("shadowChordError"), 1.5f*_shadowChordError);
+	shader->setUniform(Shader::hash("evsmExponents"), EVSM_EXPONENTS);
+	
+	glActiveTexture(GL_TEXTURE0 + 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _horizons->texture());
+	shader->setUniform(Shader::hash("horizonmap"), 4);
 
   // draw the terrain
-  glBindVertexArray(_vaoTerrain);
-  glDrawElements(GL_TRIANGLES,3*_grid->nbFaces(),GL_UNSIGNED_INT,(void *)0);
-  
-  // disable VAO
-  glBindVertexArray(0);
+  drawTiles(shader, _vaoTerrain, _grid, _visibleTiles);
+}
+
+void Viewer::drawTemporal(Shader *shader,GLuint colormap,GLuint depthmap,const glm::vec2 &size,const glm::vec2 &jitter,const glm::mat4 &reprojection) {
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, colormap);
+	shader->setUniform(Shader::hash("colormap"), 0);
+	
+	glActiveTexture(GL_TEXTURE0 + 1);
+	glBindTexture(GL_TEXTURE_2D, depthmap);
+	shader->setUniform(Shader::hash("depthmap"), 1);
+	
+	// previous accumulation
+	glActiveTexture(GL_TEXTURE0 + 2);
+	glBindTexture(GL_TEXTURE_2D, _texHistory[1-_historyIndex]);
+	shader->setUniform(Shader::hash("historymap"), 2);
+	
+	shader->setUniform(Shader::hash("gbufferSize"), size);
+	shader->setUniform(Shader::hash("jitter"), jitter);
+	shader->setUniform(Shader::hash("reprojection"), reprojection);
+	shader->setUniform(Shader::hash("reset"), _historyValid ? 0.0f : 1.0f);
+	
+	drawQuad();
 }
 
-void Viewer::drawPostProcess(GLuint id) {
+void Viewer::drawPostProcess(Shader *shader,GLuint colormap,GLuint normalmap,GLuint depthmap,const glm::vec2 &size) {
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, _texTerrainColor);
-	glUniform1i(glGetUniformLocation(id, "colormap"), 0);
+	glBindTexture(GL_TEXTURE_2D, colormap);
+	shader->setUniform(Shader::hash("colormap"), 0);
 	
 	glActiveTexture(GL_TEXTURE0 + 1);
-	glBindTexture(GL_TEXTURE_2D, _texTerrainNormal);
-	glUniform1i(glGetUniformLocation(id, "normalmap"), 1);
+	glBindTexture(GL_TEXTURE_2D, normalmap);
+	shader->setUniform(Shader::hash("normalmap"), 1);
+	
+	glActiveTexture(GL_TEXTURE0 + 2);
+	glBindTexture(GL_TEXTURE_2D, depthmap);
+	shader->setUniform(Shader::hash("depthmap"), 2);
+	
+	// (the textures can be larger than the frame, see RenderGraph)
+	shader->setUniform(Shader::hash("gbufferSize"), size);
 
 	drawQuad();
 }
 
+void Viewer::drawTimings(Shader *shader) {
+	// one row per pass: mean time over the window budget (60 Hz), with a
+	// tick at the 95th percentile (colors in the order printed by key t)
+	const std::vector<GpuTimer::Stats> stats = _gpuTimer->stats();
+	const float budget = 1000.0f/60.0f;
+	const float x0 = -0.95f, w = 0.9f, h = 0.03f;
+	
+	for (unsigned int p=0;p<stats.size();++p) {
+		const float y1 = 0.95f - 1.5f*h*p;
+		const float y0 = y1 - h;
+		const float mean = x0 + w*min(stats[p].mean/budget, 1.0f);
+		const float p95  = x0 + w*min(stats[p].p95/budget, 1.0f);
+		const glm::vec4 color(0.5f+0.5f*cos(2.4f*p), 0.5f+0.5f*cos(2.4f*p+2.1f), 0.5f+0.5f*cos(2.4f*p+4.2f), 1.0f);
+		
+		shader->setUniform(Shader::hash("rect"), glm::vec4(x0, y0, x0+w, y1));
+		shader->setUniform(Shader::hash("color"), glm::vec4(0.0f, 0.0f, 0.0f, 0.5f));
+		drawQuad();
+		
+		shader->setUniform(Shader::hash("rect"), glm::vec4(x0, y0, mean, y1));
+		shader->setUniform(Shader::hash("color"), color);
+		drawQuad();
+		
+		shader->setUniform(Shader::hash("rect"), glm::vec4(p95-0.004f, y0, p95, y1));
+		shader->setUniform(Shader::hash("color"), glm::vec4(1.0f));
+		drawQuad();
+	}
+}
+
 void Viewer::drawQuad() {
 	// draw the quad (actually just 2 triangles)
 	glBindVertexArray(_vaoQuad);
@@ -390,169 +1056,462 @@ void Viewer::drawQuad() {
 }
 
 void Viewer::paintGL() {
-	// modify the terrain
-	if (_animation) {
-		animation();
+	PROFILE_ZONE("Viewer::paintGL");
+	
+	// latest camera, light and motion of the simulation (the previous ones
+	// if nothing changed since), then the settings changed by the GUI thread
+	_state = _simulation->latest();
+	runCommands();
+	
+	// nothing published yet (default state: no camera, no light): an empty
+	// frame, the first state requests the next one
+	if (_state.step==0) {
+		glBindFramebuffer(GL_FRAMEBUFFER, _graph->backbuffer());
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		return;
 	}
 
+	// find the visible tiles and the ones to generate
+	{
+		PROFILE_ZONE("Viewer::updateTiles");
+		updateTiles();
+	}
+	
+	// next section of the uniform ring (the GPU may still read the previous ones)
+	_uniformRing->beginFrame();
+	
+	// internal resolution of the terrain: half the window with temporal upsampling,
+	// shifted by a subpixel jitter every frame (8 positions of the Halton sequence),
+	// else from the GPU time of the last frames
+	int sw, sh;
+	glm::vec2 jitter(0.0f);
+	if (_temporal) {
+		sw = std::max((_width+1)/2, 1);
+		sh = std::max((_height+1)/2, 1);
+		_jitterIndex = (_jitterIndex+1)%8;
+		jitter = glm::vec2(halton(_jitterIndex+1, 2)-0.5f, halton(_jitterIndex+1, 3)-0.5f);
+	} else {
+		updateResolution();
+		_resolution.size(_width, _height, sw, sh);
+	}
+	uploadFrame(glm::vec2(2.0f*jitter[0]/(float)sw, 2.0f*jitter[1]/(float)sh));
+
+  /***************** render graph *****************/
+  // the passes of this frame with the resources they exchange: the window
+  // sized textures are transient (allocated by the graph), the tile maps,
+  // horizon and shadow maps persist between frames
+  _graph->begin(_width, _height);
+  
+  const RenderGraph::Resource tiles    = _graph->import("tiles");
+  const RenderGraph::Resource bounds   = _graph->import("pyramid");
+  const RenderGraph::Resource horizons = _graph->import("horizons");
+  const RenderGraph::Resource shadows  = _graph->import("shadowmap");
+  const RenderGraph::Resource history  = _graph->import("history");
+  // packed G-buffer: 8-bit color, octahedral normal (the fog depth comes from the depth buffer),
+  // at the internal resolution (in the storage of the window size: no reallocation when it changes)
+  const RenderGraph::Resource color    = _graph->create("color", RenderGraph::TextureDesc(GL_RGBA8, sw, sh));
+  const RenderGraph::Resource normal   = _graph->create("normal", RenderGraph::TextureDesc(GL_RG16, sw, sh));
+  const RenderGraph::Resource depth    = _graph->create("depth", RenderGraph::TextureDesc(GL_DEPTH_COMPONENT24, sw, sh));
+  
+  typedef std::vector<RenderGraph::Resource> Resources;
+
   /***************** 1st pass: noise *****************/
-  // write in _texNormal & _texHeight
-  glBindFramebuffer(GL_FRAMEBUFFER, _fboNoise);
-  GLenum buffers1[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
-  glDrawBuffers(2, buffers1);
-  // set size & clear buffers
-  glViewport(0, 0, width(), height());
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  // activate noise shader
-  glUseProgram(_noiseShader->id());
-  drawNoise(_noiseShader->id());
-  // disable shader & fbo
-  glUseProgram(0);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  // write in the tile layers of the normal & height arrays
+  _graph->addPass("noise", Resources(), Resources(1, tiles), [this]() {
+	  // set size (the whole layer is overwritten: no need to clear)
+	  glViewport(0, 0, _tiles->resol(), _tiles->resol());
+	  // activate noise shader
+	  glUseProgram(_noiseShader->id());
+	  drawNoise(_noiseShader);
+	  // disable shader & fbo
+	  glUseProgram(0);
+	  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  });
+  
+  /***************** 1st pass (end): min/max height pyramid *****************/
+  // rebuild the chains of the new tiles, then exchange the coarse bounds with the CPU
+  _graph->addPass("minmax", Resources(1, tiles), Resources(1, bounds), [this]() {
+	  glUseProgram(_minmaxShader->id());
+	  drawMinMax(_minmaxShader);
+	  glUseProgram(0);
+	  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	  _pyramid->readback();
+  });
+  
+  // horizon maps baked since the last frame
+  _graph->addPass("horizons", Resources(), Resources(1, horizons), [this]() {
+	  _horizons->upload();
+  });
   
   /***************** 2nd pass: shadows *****************/
-	// write in _texDepth (this is done automaticaly thanks to openGL)
-  glBindFramebuffer(GL_FRAMEBUFFER, _fboShadow);
-  glDrawBuffer(GL_NONE);
-  // set size & clear buffers
-  glViewport(0, 0, width(), height()); // shadow map size
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  // activate shadow-map shader
-  glUseProgram(_shadowMapShader->id());
-  drawSceneFromLight(_shadowMapShader->id());
-  // disable shader & fbo
-  glUseProgram(0);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-  /***************** 3rd pass (optional): show shadow map *****************/
-  if (_showShadowMap) {
-  	// activate show-shadow-map shader
-		glUseProgram(_debugShader->id());
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		drawShadowMap(_debugShader->id());
-		glUseProgram(0);
+  // (the cascades are fitted to the height bounds of the pyramid)
+  Resources shadowReads;
+  shadowReads.push_back(tiles);
+  shadowReads.push_back(bounds);
+  _graph->addPass("shadows", shadowReads, Resources(1, shadows), [this]() {
+	  // cascades fitted to the camera frustum slices, all of them are re-rendered
+	  // when the terrain heights or the shadow settings changed
+	  // (none with the horizon maps, which replace the shadow map)
+	  const unsigned int render = _shadowMode==SHADOW_HORIZON ? 0 : updateCascades(_shadowDirty || !_dirtyTiles.empty());
+	  _shadowDirty = false;
+	  bool blurred = false;
+	  
+	  // the light transform of this frame, shared by the shadow and terrain passes
+	  _lightTransform->upload(*_uniformRing);
+	  
+	  // depth-only: no color writes, the slope-scaled polygon offset (the
+	  // lookups only add the chord error of the coarse grid)
+	  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	  glEnable(GL_POLYGON_OFFSET_FILL);
+	  glPolygonOffset(2.0f, 4.0f);
+	  
+	  for (int c=0;c<_nbCascades;++c) {
+	  	if (!(render & (1u<<c))) {
+	  		// (cached cascades only: the horizon maps have no shadow map to reuse)
+	  		if (_shadowMode != SHADOW_HORIZON) {
+	  			_skippedShadowPasses++;
+	  		}
+	  		continue;
+	  	}
+	  	
+			// write in the cascade layer of _texDepth (this is done automaticaly thanks to openGL)
+			glBindFramebuffer(GL_FRAMEBUFFER, _fboShadow);
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _texDepth, 0, c);
+			glDrawBuffer(GL_NONE);
+			// set size & clear buffers
+			glViewport(0, 0, _shadowSize, _shadowSize); // shadow map size
+			glClear(GL_DEPTH_BUFFER_BIT);
+			// activate shadow-map shader
+			glUseProgram(_shadowMapShader->id());
+			drawSceneFromLight(_shadowMapShader, c);
+			// disable shader & fbo
+			glUseProgram(0);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			
+			// VSM/EVSM: blur the moments of the re-rendered cascade only
+			if (_shadowMode != SHADOW_PCF) {
+				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				glDisable(GL_POLYGON_OFFSET_FILL);
+				glUseProgram(_shadowBlurShader->id());
+				drawShadowBlur(_shadowBlurShader, c);
+				glUseProgram(0);
+				glBindFramebuffer(GL_FRAMEBUFFER, 0);
+				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				glEnable(GL_POLYGON_OFFSET_FILL);
+				blurred = true;
+			}
+		}
+		
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDisable(GL_POLYGON_OFFSET_FILL);
+		
+		// mipmaps of the blurred moments (filtered fetch in the terrain shader)
+		if (blurred) {
+			glBindTexture(GL_TEXTURE_2D_ARRAY, _texMoments);
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		}
+	});
+
+	/***************** 3rd pass: render terrain *****************/
+	// write in the color, normal & depth textures, or straight into the
+	// backbuffer when no post-process effect is enabled at full resolution (pp would be a copy)
+	const bool upscale = !_temporal && (sw!=_width || sh!=_height);
+	const bool postProcess = _postEffects!=0 || upscale || _temporal;
+	Resources terrainReads;
+	terrainReads.push_back(tiles);
+	terrainReads.push_back(horizons);
+	terrainReads.push_back(shadows);
+	Resources terrainWrites;
+	if (postProcess) {
+		terrainWrites.push_back(color);
+		terrainWrites.push_back(normal);
+		terrainWrites.push_back(depth);
 	} else {
-		/***************** 4th pass: render terrain *****************/
-		// write in _texTerrainColor, _texTerrainNormal & _texTerrainDepth
-		glBindFramebuffer(GL_FRAMEBUFFER, _fboTerrain);
-		GLenum buffers2[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
-		glDrawBuffers(2, buffers2);
+		terrainWrites.push_back(RenderGraph::BACKBUFFER);
+	}
+	_graph->addPass("terrain", terrainReads, terrainWrites, [this]() {
 		// clear buffers
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		// activate terrain shader
 		glUseProgram(_terrainShader->id());
-		drawSceneFromCamera(_terrainShader->id());
-		// disable shader & fbo
-		glUseProgram(0);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		
-		/***************** 5th pass: post processing *****************/
-		// activate pp shader
-		glUseProgram(_postProcessShader->id());
-		// clear buffers
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		drawPostProcess(_postProcessShader->id());
+		drawSceneFromCamera(_terrainShader);
 		// disable shader
 		glUseProgram(0);
+	});
+	
+	/***************** 4th pass (temporal upsampling): accumulation *****************/
+	// blend the jittered frame into the history reprojected with the camera
+	// motion (the history is persistent: the pass is never culled)
+	if (_temporal) {
+		if (_width!=_historyWidth || _height!=_historyHeight) {
+			initHistory();
+		}
+		
+		const glm::mat4 viewProj = _state.projMat*_state.mdvMat;
+		const glm::mat4 reprojection = _prevViewProj*glm::inverse(viewProj);
+		_prevViewProj = viewProj;
+		
+		Resources temporalReads;
+		temporalReads.push_back(color);
+		temporalReads.push_back(depth);
+		temporalReads.push_back(history);
+		_graph->addPass("temporal", temporalReads, Resources(1, history), [this,color,depth,sw,sh,jitter,reprojection]() {
+			// write in the other history texture
+			_historyIndex = 1-_historyIndex;
+			glBindFramebuffer(GL_FRAMEBUFFER, _fboHistory);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _texHistory[_historyIndex], 0);
+			glViewport(0, 0, _historyWidth, _historyHeight);
+			glUseProgram(_temporalShader->id());
+			drawTemporal(_temporalShader, _graph->texture(color), _graph->texture(depth), glm::vec2((float)sw, (float)sh), jitter, reprojection);
+			glUseProgram(0);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			_historyValid = true;
+		});
+	}
+	
+	/***************** 4th pass: post processing *****************/
+	if (postProcess) {
+		Resources ppReads;
+		ppReads.push_back(_temporal ? history : color);
+		ppReads.push_back(normal);
+		ppReads.push_back(depth);
+		const unsigned int ppKey = _postEffects | (upscale ? UPSCALE_EFFECT : 0) | (_temporal ? TEMPORAL_EFFECT : 0);
+		_graph->addPass("pp", ppReads, Resources(1, RenderGraph::BACKBUFFER), [this,color,normal,depth,ppKey,sw,sh]() {
+			// activate the pp shader of the enabled effects (edge-aware upscaling of
+			// the lower resolution, or the accumulated history)
+			Shader *shader = _postProcessShaders->get(ppKey);
+			const GLuint colormap = (ppKey & TEMPORAL_EFFECT) ? _texHistory[_historyIndex] : _graph->texture(color);
+			glUseProgram(shader->id());
+			// clear buffers
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			drawPostProcess(shader, colormap, _graph->texture(normal), _graph->texture(depth), glm::vec2((float)sw, (float)sh));
+			// disable shader
+			glUseProgram(0);
+		});
+	}
+
+	/***************** 5th pass (optional): show shadow map *****************/
+	// last write of the backbuffer: terrain and pp are culled
+	if (_state.showShadowMap) {
+		_graph->addPass("show-shadow-map", Resources(1, shadows), Resources(1, RenderGraph::BACKBUFFER), [this]() {
+			// activate show-shadow-map shader
+			glUseProgram(_debugShader->id());
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			drawShadowMap(_debugShader);
+			glUseProgram(0);
+		});
+	}
+	
+	/***************** 6th pass (optional): GPU timings *****************/
+	// drawn over the frame (reads the backbuffer, so the pass before is kept)
+	if (_showTimings) {
+		const Resources frame(1, RenderGraph::BACKBUFFER);
+		_graph->addPass("timings", frame, frame, [this]() {
+			glDisable(GL_DEPTH_TEST);
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			glUseProgram(_timingsShader->id());
+			drawTimings(_timingsShader);
+			glUseProgram(0);
+			glDisable(GL_BLEND);
+			glEnable(GL_DEPTH_TEST);
+		});
+	}
+	
+	/***************** 7th pass (optional): capture *****************/
+	// asynchronous copy of the final frame, the one of 2 frames ago is sent to the writer
+	if (_capture->capturing()) {
+		const Resources frame(1, RenderGraph::BACKBUFFER);
+		_graph->addPass("capture", frame, frame, [this]() {
+			_capture->readback(_graph->backbuffer(), _width, _height);
+		});
+	}
+	
+	{
+		PROFILE_ZONE("RenderGraph::compile");
+		_graph->compile();
 	}
+	
+	// each executed pass is timed (results read back a few frames later)
+	_gpuTimer->beginFrame();
+	{
+		PROFILE_ZONE("RenderGraph::execute");
+		_graph->execute();
+	}
+	_gpuTimer->endFrame();
+	
+	// the section of this frame is free again once its commands are done
+	_uniformRing->endFrame();
+	
+	// keep drawing while something changes on its own
+	// (animation, tiles being generated, bounds or horizons on their way)
+	// (queued when called from the render thread)
+	const bool continuous = _state.animation || !_dirtyTiles.empty() || _pyramid->pending() || _horizons->busy();
+	QMetaObject::invokeMethod(_scheduler, "setContinuous", Qt::AutoConnection, Q_ARG(bool, continuous));
 }
 
 void Viewer::resizeGL(int width,int height) {
-  _cam->initialize(width,height,false);
+  PROFILE_ZONE("Viewer::resizeGL");
+  // (the camera follows on the simulation thread, the render targets in the
+  // next frame, reallocated once the size settles)
+  _width = width;
+  _height = height;
   glViewport(0,0,width,height);
-  initFBO();
-  updateGL();
 }
 
-void Viewer::mousePressEvent(QMouseEvent *me) {
-  const glm::vec2 p((float)me->x(),(float)(height()-me->y()));
+void Viewer::paintEvent(QPaintEvent *) {
+  // drawn by the render thread (the context is not current on this one)
+  _scheduler->requestFrame();
+}
 
-  if(me->button()==Qt::LeftButton) {
-    _cam->initRotation(p);
-    _mode = false;
-  } else if(me->button()==Qt::MidButton) {
-    _cam->initMoveZ(p);
-    _mode = false;
-  } else if(me->button()==Qt::RightButton) {
-    _light[0] = (p[0]-(float)(width()/2))/((float)(width()/2));
-    _light[1] = (p[1]-(float)(height()/2))/((float)(height()/2));
-    _light[2] = 1.0f-std::max(fabs(_light[0]),fabs(_light[1]));
-    _light = glm::normalize(_light);
-    _mode = true;
-  } 
+void Viewer::resizeEvent(QResizeEvent *re) {
+  Simulation::Input input(Simulation::Input::RESIZE);
+  input.width = re->size().width();
+  input.height = re->size().height();
+  _simulation->post(input);
+  _renderThread->resize(input.width, input.height);
+}
 
-  updateGL();
+void Viewer::closeEvent(QCloseEvent *) {
+  stopRendering();
 }
 
-void Viewer::mouseMoveEvent(QMouseEvent *me) {
-  const glm::vec2 p((float)me->x(),(float)(height()-me->y()));
- 
-  if(_mode) {
-    // light mode
-    _light[0] = (p[0]-(float)(width()/2))/((float)(width()/2));
-    _light[1] = (p[1]-(float)(height()/2))/((float)(height()/2));
-    _light[2] = 1.0f-std::max(fabs(_light[0]),fabs(_light[1]));
-    _light = glm::normalize(_light);
-  } else {
-    // camera mode
-    _cam->move(p);
-  }
+void Viewer::mousePressEvent(QMouseEvent *me) {
+  Simulation::Input input(Simulation::Input::MOUSE_PRESS);
+  input.pos = glm::vec2((float)me->x(),(float)(height()-me->y()));
+  input.button = me->button();
+  _simulation->post(input);
+}
 
-  updateGL();
+void Viewer::mouseMoveEvent(QMouseEvent *me) {
+  Simulation::Input input(Simulation::Input::MOUSE_MOVE);
+  input.pos = glm::vec2((float)me->x(),(float)(height()-me->y()));
+  _simulation->post(input);
 }
 
 void Viewer::keyPressEvent(QKeyEvent *ke) {
-  const float movementSpeed = 10.0;
-
-	// keys zqsd: move camera
-	if(ke->key()==Qt::Key_Z) {
-    _cam->addZ(movementSpeed);
+  // keys zqsd (camera), a (animation), i (init camera), m (show the shadow
+  // map), space (next texture): applied by the simulation
+  Simulation::Input input(Simulation::Input::KEY);
+  input.key = ke->key();
+  _simulation->post(input);
+
+  // the render settings are changed by the render thread, before its next frame
+  const int key = ke->key();
+  runOnRenderThread([this,key]() {
+    renderKey(key);
+  });
+  
+  // key p: write the CPU zones of all the threads (chrome://tracing)
+  if (ke->key()==Qt::Key_P) {
+    if (Profiler::dump("trace.json")) {
+      cout << "trace.json written" << endl;
+    }
   }
-
-  if(ke->key()==Qt::Key_S) {
-    _cam->addZ(-movementSpeed);
+  
+  // key f: next frame pacing (vsync, 30, 60 or 120 fps), prints the intervals of the previous one
+  if (ke->key()==Qt::Key_F) {
+    const FrameScheduler::Intervals intervals = _scheduler->intervals();
+    cout << "frame intervals: mean " << intervals.mean << " / p95 " << intervals.p95 << " / max " << intervals.max << " ms, "
+         << intervals.late << " late frames" << endl;
+    
+    if (_scheduler->mode()==FrameScheduler::VSYNC) {
+      _scheduler->setMode(FrameScheduler::TARGET_FPS, 30.0f);
+    } else if (_scheduler->fps()<120.0f) {
+      _scheduler->setMode(FrameScheduler::TARGET_FPS, 2.0f*_scheduler->fps());
+    } else {
+      _scheduler->setMode(FrameScheduler::VSYNC);
+    }
+    
+    // (the scheduler belongs to this thread)
+    const float rate = _scheduler->mode()==FrameScheduler::TARGET_FPS ? _scheduler->fps() : 60.0f;
+    runOnRenderThread([this,rate]() {
+      _frameRate = rate;
+    });
   }
 
-  if(ke->key()==Qt::Key_Q) {
-    _cam->addX(movementSpeed);
-  }
+  _scheduler->requestFrame();
+}
 
-  if(ke->key()==Qt::Key_D) {
-    _cam->addX(-movementSpeed);
+void Viewer::renderKey(int key) {
+  // key r: reload shaders 
+  if (key==Qt::Key_R) {
+    reloadShaders();
   }
-
-  // key a: play/stop animation
-  if(ke->key()==Qt::Key_A) {
-    _animation = !_animation;
+  
+  // key k: next shadow map size (512 to 4096, per cascade)
+  if (key==Qt::Key_K) {
+    setShadowMap(_shadowSize>=4096 ? 512 : _shadowSize*2, _shadowFormat);
   }
-
-  // key i: init camera
-  if(ke->key()==Qt::Key_I) {
-    _cam->initialize(width(),height(),true);
+  
+  // key v: next shadow filtering (PCF, VSM, EVSM, horizon maps)
+  if (key==Qt::Key_V) {
+    setShadowMode((ShadowMode)((_shadowMode + 1) % 4));
   }
-
-  // key r: reload shaders 
-  if (ke->key()==Qt::Key_R) {
-    reloadShaders();
+  
+  // key t: show the GPU time of the passes (and print them)
+  if (key==Qt::Key_T) {
+    _showTimings = !_showTimings;
+    const std::vector<GpuTimer::Stats> stats = _gpuTimer->stats();
+    cout << "pass: mean / p50 / p95 / p99 (ms)" << endl;
+    for (unsigned int p=0;p<stats.size();++p) {
+      cout << stats[p].name << ": " << stats[p].mean << " / " << stats[p].p50 << " / " << stats[p].p95 << " / " << stats[p].p99 << endl;
+    }
+    cout << _gpuTimer->droppedFrames() << " frames dropped, terrain at " << 100.0f*_resolution.scale() << "% of the window" << endl;
   }
   
-  // key m: show the shadow map 
-  if (ke->key()==Qt::Key_M) {
-    _showShadowMap = !_showShadowMap;
+  // key l: start/stop the CSV log of the GPU timings
+  if (key==Qt::Key_L) {
+    if (_gpuTimer->logging()) {
+      _gpuTimer->stopLog();
+    } else {
+      _gpuTimer->startLog("gpu-timings.csv");
+    }
   }
   
-  // key space: use the next texture
-  if (ke->key()==Qt::Key_Space) {
-    _currentTexture = (_currentTexture + 1) % 5;
+  // key g: print the passes of the last frame
+  if (key==Qt::Key_G) {
+    _graph->dump();
+  }
+  
+  // keys 1, 2, 3: toggle the fog, pixel and drosophila post-process effects
+  if (key==Qt::Key_1) {
+    setPostEffects(_postEffects ^ FOG_EFFECT);
+  }
+  if (key==Qt::Key_2) {
+    setPostEffects(_postEffects ^ PIXEL_EFFECT);
+  }
+  if (key==Qt::Key_3) {
+    setPostEffects(_postEffects ^ DROSOPHILA_EFFECT);
+  }
+  
+  // key x: dynamic resolution on/off
+  if (key==Qt::Key_X) {
+    setDynamicResolution(!_resolution.enabled());
+    cout << "dynamic resolution " << (_resolution.enabled() ? "on" : "off") << endl;
+  }
+  
+  // key c: start/stop the capture (capture.y4m)
+  if (key==Qt::Key_C) {
+    if (_capture->capturing()) {
+      _capture->stop();
+    } else {
+      startCapture("capture.y4m");
+    }
+  }
+  
+  // key u: temporal upsampling on/off
+  if (key==Qt::Key_U) {
+    setTemporalUpsampling(!_temporal);
+    cout << "temporal upsampling " << (_temporal ? "on" : "off") << endl;
   }
-
-  updateGL();
 }
 
 void Viewer::initializeGL() {
-  // make this window the current one
-  makeCurrent();
-
+  PROFILE_ZONE("Viewer::initializeGL");
+  
+  // (the context of the window, or the one of the benchmark, is current)
   // init and chack glew
   if (glewInit()!=GLEW_OK) {
     cerr << "Warning: glewInit failed!" << endl;
@@ -571,10 +1530,9 @@ void Viewer::initializeGL() {
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_TEXTURE_2D);
   glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
-  glViewport(0,0,width(),height());
-
-  // initialize camera
-  _cam->initialize(width(),height(),true);
+  
+  // (resizeGL follows with the window size: the one handed to the render
+  // thread by startRendering, or the widget size in the benchmark)
 
   // init shaders 
   createShaders();
@@ -582,12 +1540,122 @@ void Viewer::initializeGL() {
   // init VAO/VBO
   createVAO();
   createFBO();
-  initFBO();
+  initShadowFBO();
   
   // init Textures
   createTextures();
-  
-  // starts the timer
-  _timer->start();
 }
 
+
+void Viewer::setGridResolution(unsigned int resol) {
+	_ndResol = resol;
+	
+	delete _grid;
+	delete _shadowGrid;
+	_grid = new Grid(_ndResol, -_len, _len);
+	_shadowGrid = new Grid(_ndResol/2, -_len, _len);
+	_shadowChordError = chordError(_terrainGraph, _ndResol, _ndResol/2);
+}
+
+// mean and percentiles of a series (ms), as a JSON object
+static std::string jsonStats(std::vector<float> values) {
+	float mean = 0.0f;
+	for (unsigned int i=0;i<values.size();++i) {
+		mean += values[i];
+	}
+	mean /= std::max((float)values.size(), 1.0f);
+	
+	std::sort(values.begin(), values.end());
+	const float p50 = values.empty() ? 0.0f : values[(values.size()-1)*50/100];
+	const float p95 = values.empty() ? 0.0f : values[(values.size()-1)*95/100];
+	const float p99 = values.empty() ? 0.0f : values[(values.size()-1)*99/100];
+	
+	std::ostringstream s;
+	s << "{\"mean\":" << mean << ",\"p50\":" << p50 << ",\"p95\":" << p95 << ",\"p99\":" << p99 << "}";
+	return s.str();
+}
+
+void Viewer::benchmark(unsigned int nbFrames,unsigned int nbWarmup) {
+	typedef std::chrono::steady_clock Clock;
+	
+	initializeGL();
+	resizeGL(width(), height());
+	
+	// no simulation thread: the camera is placed and moved from here
+	Simulation::Input input(Simulation::Input::RESIZE);
+	input.width = width();
+	input.height = height();
+	_simulation->post(input);
+	_simulation->update(0.0f);
+	
+	// comparable runs: always at the widget size
+	setDynamicResolution(false);
+	
+	// offscreen backbuffer at the widget size
+	GLuint fbo, buffers[2];
+	glGenFramebuffers(1, &fbo);
+	glGenRenderbuffers(2, buffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, buffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width(), height());
+	glBindRenderbuffer(GL_RENDERBUFFER, buffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width(), height());
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, buffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, buffers[1]);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		cerr << "Warning: benchmark FBO not complete!" << endl;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	_graph->setBackbuffer(fbo);
+	
+	std::vector<float> frameTimes;
+	for (unsigned int f=0;f<nbWarmup+nbFrames;++f) {
+		// the GPU timings start after the warm-up, with room for every frame
+		if (f==nbWarmup) {
+			delete _gpuTimer;
+			_gpuTimer = new GpuTimer(4, std::max(nbFrames, 1u));
+			_graph->setTimer(_gpuTimer);
+		}
+		
+		// fixed camera path: forward with a slow sway (animation at 60 Hz)
+		_simulation->camera()->addZ(1.0f);
+		_simulation->camera()->addX(2.0f*sin(0.05f*(float)f));
+		_simulation->update(1.0f/60.0f);
+		
+		// the frame is done once the GPU is
+		const Clock::time_point start = Clock::now();
+		paintGL();
+		glFinish();
+		const float ms = std::chrono::duration<float,std::milli>(Clock::now()-start).count();
+		
+		if (f>=nbWarmup) {
+			frameTimes.push_back(ms);
+		}
+	}
+	
+	// results of the last frame
+	_gpuTimer->beginFrame();
+	_gpuTimer->endFrame();
+	
+	// one line: {"config":...,"frame_ms":...,"passes":{...}}
+	std::ostringstream result;
+	result << "{\"config\":{\"frames\":" << nbFrames << ",\"warmup\":" << nbWarmup
+	       << ",\"width\":" << width() << ",\"height\":" << height() << ",\"grid\":" << _ndResol
+	       << ",\"renderer\":\"" << (const char *)glGetString(GL_RENDERER) << "\"}"
+	       << ",\"frame_ms\":" << jsonStats(frameTimes) << ",\"passes\":{";
+	
+	const std::vector<GpuTimer::Stats> stats = _gpuTimer->stats();
+	for (unsigned int p=0;p<stats.size();++p) {
+		result << (p ? "," : "") << "\"" << stats[p].name << "\":" << jsonStats(_gpuTimer->history(p));
+	}
+	result << "},\"gpu_dropped_frames\":" << _gpuTimer->droppedFrames() << "}";
+	cout << result.str() << endl;
+	
+	// frames in flight of the capture (--capture)
+	_capture->stop();
+	
+	_graph->setBackbuffer(0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(2, buffers);
+}
@@ -18,22 +18,100 @@
 #include <QGLWidget>
 #include <QMouseEvent>
 #include <QKeyEvent>
-#include <QTimer>
+#include <QMutex>
+#include <atomic>
+#include <functional>
 #include <stack>
+#include <vector>
 
 #include "camera.h"
 #include "shader.h"
 #include "grid.h"
+#include "noisegraph.h"
+#include "tilecache.h"
+#include "heightpyramid.h"
+#include "lighttransform.h"
+#include "horizonbaker.h"
+#include "uniformring.h"
+#include "rendergraph.h"
+#include "gputimer.h"
+#include "profiler.h"
+#include "framescheduler.h"
+#include "shaderpermutations.h"
+#include "dynamicresolution.h"
+#include "simulation.h"
+#include "renderthread.h"
+#include "framecapture.h"
 
+// The GUI thread only handles the window events: the input is applied by
+// the simulation thread, the frames are drawn by the render thread (with
+// the GL context) from the latest state published by the simulation.
 class Viewer : public QGLWidget {
+  friend class RenderThread;
+
  public:
+  static const int MAX_CASCADES = LightTransform::MAX_CASCADES;
+  
+  // shadow filtering: hardware PCF, blurred moments (variance / exponential
+  // variance), or horizon maps (no shadow map at all)
+  enum ShadowMode {SHADOW_PCF=0, SHADOW_VSM=1, SHADOW_EVSM=2, SHADOW_HORIZON=3};
+
   Viewer(char *filename,const QGLFormat &format=QGLFormat::defaultFormat());
   ~Viewer();
   
+  // shadow map size of each cascade (rounded up to a power of two) and depth format
+  void setShadowMap(unsigned int size,GLenum format=GL_DEPTH_COMPONENT24);
+  void setShadowMode(ShadowMode mode);
+  
+  // number of cascade renders saved by the cached shadow map (any thread)
+  inline unsigned int skippedShadowPasses() const {return _skippedShadowPasses.load(std::memory_order_relaxed);}
+  
+  // post-process effects (mask), without any the terrain is drawn straight into the window.
+  // Each mask has its own precompiled pp program: switching compiles nothing
+  // (UPSCALE_EFFECT and TEMPORAL_EFFECT are set by the viewer when the terrain is rendered
+  // at a lower resolution, resp. accumulated over the frames)
+  enum PostEffect {FOG_EFFECT=1, PIXEL_EFFECT=2, DROSOPHILA_EFFECT=4, ALL_EFFECTS=7, UPSCALE_EFFECT=8, TEMPORAL_EFFECT=16};
+  void setPostEffects(unsigned int effects);
+  inline unsigned int postEffects() const {return _postEffects;}
+  
+  // frame pacing (vsync by default)
+  inline FrameScheduler *scheduler() const {return _scheduler;}
+  
+  // internal resolution of the terrain, scaled down when the GPU time
+  // exceeds the frame period (on by default)
+  void setDynamicResolution(bool enabled);
+  inline const DynamicResolution &resolution() const {return _resolution;}
+  
+  // temporal upsampling: the terrain is rendered at half the window size with a
+  // subpixel jitter, then accumulated at the window size (replaces the dynamic resolution)
+  void setTemporalUpsampling(bool enabled);
+  inline bool temporalUpsampling() const {return _temporal;}
+  
+  // terrain grid resolution (before the GL initialization)
+  void setGridResolution(unsigned int resol);
+  
+  // record the frames: Y4M video (name.y4m) or image sequence (name.ppm,
+  // name.png), until stopCapture or a resize
+  void startCapture(const std::string &filename);
+  void stopCapture();
+  
+  // start the simulation and render threads (the window is shown) / stop them
+  void startRendering();
+  void stopRendering();
+  
+  // headless benchmark: the widget is never shown, the GL context of the
+  // caller is current. Renders nbFrames frames of the whole pipeline at the
+  // widget size into an fbo, along a fixed camera path, then prints the
+  // frame times and the GPU time of each pass as one JSON line
+  void benchmark(unsigned int nbFrames,unsigned int nbWarmup=10);
+  
  protected :
   virtual void paintGL();
   virtual void initializeGL();
   virtual void resizeGL(int width,int height);
+  virtual void paintEvent(QPaintEvent *pe);
+  virtual void resizeEvent(QResizeEvent *re);
+  virtual void closeEvent(QCloseEvent *ce);
   virtual void keyPressEvent(QKeyEvent *ke);
   virtual void mousePressEvent(QMouseEvent *me);
   virtual void mouseMoveEvent(QMouseEvent *me);
@@ -48,7 +126,8 @@ class Viewer : public QGLWidget {
   void loadTexture(GLuint id, const char *filename);
 
 	void createFBO();
-	void initFBO();
+	void initShadowFBO();
+	void initHistory();
   void deleteFBO();
 
   void createShaders();
@@ -56,40 +135,83 @@ class Viewer : public QGLWidget {
   void reloadShaders();
   
   // drawing functions (one for each pass/shader)
-  void drawNoise(GLuint id);
-  void drawSceneFromLight(GLuint id);
-  void drawShadowMap(GLuint id);
-  void drawSceneFromCamera(GLuint id);
-  void drawPostProcess(GLuint id);
+  void drawNoise(Shader *shader);
+  void drawMinMax(Shader *shader);
+  void drawSceneFromLight(Shader *shader,int cascade);
+  void drawShadowBlur(Shader *shader,int cascade);
+  void drawShadowMap(Shader *shader);
+  void drawSceneFromCamera(Shader *shader);
+  void drawTemporal(Shader *shader,GLuint colormap,GLuint depthmap,const glm::vec2 &size,const glm::vec2 &jitter,const glm::mat4 &reprojection);
+  void drawPostProcess(Shader *shader,GLuint colormap,GLuint normalmap,GLuint depthmap,const glm::vec2 &size);
+  void drawTimings(Shader *shader);
   
   void drawQuad();
+  void drawTiles(Shader *shader,GLuint vao,const Grid *grid,const std::vector<glm::ivec3> &tiles);
   
-  // animation
-  void animation();
+  // infinite terrain: loaded and visible tiles, and their generation
+  void updateTiles();
+  void tileBounds(int i,int j,float &hmin,float &hmax) const;
+  
+  // cascaded shadow maps: fit the cascades and store the ones to re-render
+  // in the light transform (returns their mask)
+  unsigned int updateCascades(bool force);
+  void heightBounds(float &hmin,float &hmax) const;
+  bool tileVisible(const glm::mat4 &mvp,int i,int j) const;
+  
+  // GL work asked by the GUI thread: run by the render thread before its
+  // next frame (at once without render thread)
+  void runOnRenderThread(const std::function<void()> &command);
+  void runCommands();
+  void renderKey(int key);
+  
+  // per-frame constants: std140 "Frame" block of the shaders
+  static const GLuint FRAME_BINDING = 1;
+  struct FrameBlock {
+    glm::mat4 mdvMat;
+    glm::mat4 projMat;
+    glm::mat4 normalMat;
+    glm::vec4 light;
+    glm::vec4 lightWorld;
+    glm::vec4 motion;
+  };
+  // (jitter: offset of the projection in clip space)
+  void uploadFrame(const glm::vec2 &jitter);
+  
+  // feed the dynamic resolution with the last GPU timings
+  void updateResolution();
 
   Grid   *_grid;   // the grid
-  Camera *_cam;    // the camera
-
-	QTimer				*_timer;			// timer to refresh the drawing
-  glm::vec3 		_light;				// light direction
-  glm::vec3 		_motion; 			// motion offset for the noise texture
-  bool      		_mode;   			// camera motion or light motion
-  bool					_showShadowMap;
-  bool					_animation;		// boolean that controls the animation
+  Grid   *_shadowGrid; // coarser grid of the depth-only shadow pass
+  float   _shadowChordError; // height of the coarse grid above the camera one (lookup bias)
+
+	FrameScheduler *_scheduler;	// decides when to redraw
+	Simulation		*_simulation;	// camera, light, motion and toggles (own thread)
+	RenderThread	*_renderThread;	// owns the context once started
+	Simulation::State _state;		// frame state used by the current frame
+	QMutex				_commandsMutex;
+	std::vector<std::function<void()> > _commands; // queued for the render thread
   unsigned int	_ndResol;
 	float					_len; 				// terrain is of size len*len
-	int 					_currentTexture;
+	int						_width,_height;	// window size seen by the render thread
+	NoiseGraph		_terrainGraph;	// terrain height function (GLSL + CPU)
+	int						_viewTiles;		// radius (in tiles) of the loaded area around the camera
 
   // les shaders
   Shader *_noiseShader;
+  Shader *_minmaxShader;
   Shader *_shadowMapShader;
+  Shader *_shadowBlurShader;
   Shader *_debugShader;
   Shader *_terrainShader;
-  Shader *_postProcessShader;
+  Shader *_temporalShader;
+  ShaderPermutations *_postProcessShaders; // one program per effect mask
+  Shader *_timingsShader;
   
   // vbo/vao ids
   GLuint _vaoTerrain;
   GLuint _terrain[2];
+  GLuint _vaoShadow;
+  GLuint _shadowTerrain[2];
   GLuint _vaoQuad;
   GLuint _quad;
   
@@ -97,23 +219,69 @@ class Viewer : public QGLWidget {
   GLuint _texWater[5];
   
   // fbo id and associated shader textures
-  // noiseShader
-  GLuint _fboNoise;
+  // noiseShader: one layer of the tile arrays per visible tile
+  TileCache *_tiles;
+  
+  std::vector<glm::ivec3> _loadedTiles;  // (i,j,layer), all the tiles around the camera
+  std::vector<glm::ivec3> _visibleTiles; // loaded tiles in the camera frustum
+  std::vector<glm::ivec3> _dirtyTiles;   // loaded tiles to (re)generate
+  std::vector<glm::ivec3> _casterTiles[MAX_CASCADES]; // loaded tiles in the light box of each cascade
+  
+  // minmaxShader: min/max height chain of each tile layer
+  HeightPyramid *_pyramid;
   
-  GLuint _texNormal;
-  GLuint _texHeight;
+  // horizon maps of the tile layers (shadows and ambient occlusion), baked on the CPU
+  HorizonBaker *_horizons;
   
   // shadowShader
   GLuint _fboShadow;
   
-  GLuint _texDepth;
+  GLuint _texDepth;           // one layer per cascade
+  unsigned int _shadowSize;   // power of two, independent of the window
+  int          _nbCascades;   // split along the view depth
+  GLenum       _shadowFormat; // GL_DEPTH_COMPONENT16/24/32F
+  LightTransform *_lightTransform; // cascade matrices shared by all passes
+  UniformRing    *_uniformRing;    // uniform blocks of the frames in flight
+  bool         _shadowDirty;  // shadow map has to be re-rendered
+  std::atomic<unsigned int> _skippedShadowPasses; // counted by the render thread
+  
+  // shadowBlurShader: moments of the cascades at half the shadow map size
+  ShadowMode _shadowMode;
+  GLuint _fboMoments;
+  GLuint _texMoments;         // one mipmapped layer per cascade
+  GLuint _texMomentsTmp;      // horizontal pass
+  GLuint _samplerDepth;       // reads the depths without comparison
+  
+  // postProcessShader
+  unsigned int _postEffects;
+  
+  // terrain resolution (the pp pass upscales to the window)
+  DynamicResolution _resolution;
+  unsigned int      _timedFrame;  // last GPU frame given to _resolution
+  
+  // frame rate of the scheduler (60 with vsync), the copy of the render
+  // thread: the frame budget and the rate of the captured video
+  float _frameRate;
+  
+  // temporalShader: history of the accumulated frames (ping-pong, window size)
+  bool         _temporal;
+  bool         _historyValid;   // false: restart from the current frame
+  GLuint       _fboHistory;
+  GLuint       _texHistory[2];
+  int          _historyIndex;   // written by the last frame
+  int          _historyWidth,_historyHeight;
+  unsigned int _jitterIndex;
+  glm::mat4    _prevViewProj;   // camera of the previous frame (no jitter)
+  
+  // passes of the frame, owns the window sized textures (terrain and pp)
+  RenderGraph *_graph;
   
-  // terrainShader
-  GLuint _fboTerrain;
+  // timingsShader: GPU time of each pass (overlay)
+  GpuTimer *_gpuTimer;
+  bool      _showTimings;
   
-  GLuint _texTerrainColor;
-  GLuint _texTerrainNormal;
-  GLuint _texTerrainDepth;
+  // frames read back to a video or images (last pass of the frame)
+  FrameCapture *_capture;
 };
 
 #endif // VIEWER_H